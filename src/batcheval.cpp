@@ -0,0 +1,360 @@
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+
+#include "batcheval.h"
+#include "game.h"
+#include "eval.h"
+#include "bitboard.h"
+#include "constants.h"
+
+using namespace Bitboard;
+
+
+void BatchEval::PositionBatch::add(const Game::Position& pos) {
+    ownPieces.push_back(pos.ownPieces);
+    pawns.push_back(pos.pawns);
+    filesAndRanks.push_back(pos.filesAndRanks);
+    diagonals.push_back(pos.diagonals);
+    knights.push_back(pos.knights);
+    kings.push_back(pos.kings);
+    whitesTurn.push_back(pos.whitesTurn);
+}
+
+void BatchEval::PositionBatch::clear() {
+    ownPieces.clear();
+    pawns.clear();
+    filesAndRanks.clear();
+    diagonals.clear();
+    knights.clear();
+    kings.clear();
+    whitesTurn.clear();
+}
+
+size_t BatchEval::PositionBatch::size() const {
+    return ownPieces.size();
+}
+
+
+#if defined(__AVX2__) && !(defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__))
+//popcount of every 64 bit lane, by looking up the popcount of every nibble
+static inline __m256i popcount256(__m256i v) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                            0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i lowNibbles = _mm256_set1_epi8(0x0f);
+    __m256i low = _mm256_and_si256(v, lowNibbles);
+    __m256i high = _mm256_and_si256(_mm256_srli_epi16(v, 4), lowNibbles);
+    __m256i counts = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, low), _mm256_shuffle_epi8(lookup, high));
+    return _mm256_sad_epu8(counts, _mm256_setzero_si256());
+}
+#endif
+
+void BatchEval::evaluateMaterial(const PositionBatch& batch, size_t first, int count, int32_t *material, int32_t *gamePhase) {
+    const short *values = Eval::params->pieceValues;
+    int i = 0;
+
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+    for(; i + 8 <= count; i += 8) {
+        size_t index = first + i;
+        __m512i own = _mm512_loadu_si512(batch.ownPieces.data() + index);
+        __m512i pawns = _mm512_loadu_si512(batch.pawns.data() + index);
+        __m512i filesAndRanks = _mm512_loadu_si512(batch.filesAndRanks.data() + index);
+        __m512i diagonals = _mm512_loadu_si512(batch.diagonals.data() + index);
+        __m512i knights = _mm512_loadu_si512(batch.knights.data() + index);
+        __m512i kings = _mm512_loadu_si512(batch.kings.data() + index);
+
+        uint64_t sideBytes;
+        std::memcpy(&sideBytes, batch.whitesTurn.data() + index, sizeof(sideBytes));
+        __m512i side = _mm512_cvtepu8_epi64(_mm_cvtsi64_si128(sideBytes));
+        __mmask8 whiteToMove = _mm512_test_epi64_mask(side, side);
+
+        __m512i occupied = _mm512_or_si512(_mm512_or_si512(pawns, knights), _mm512_or_si512(_mm512_or_si512(filesAndRanks, diagonals), kings));
+        __m512i white = _mm512_mask_blend_epi64(whiteToMove, _mm512_andnot_si512(own, occupied), own);
+
+        __m512i pieces[5] = {
+            pawns,
+            knights,
+            _mm512_andnot_si512(filesAndRanks, diagonals),
+            _mm512_andnot_si512(diagonals, filesAndRanks),
+            _mm512_and_si512(filesAndRanks, diagonals)
+        };
+
+        __m512i phase = _mm512_add_epi64(_mm512_popcnt_epi64(_mm512_or_si512(pieces[1], pieces[2])),
+                        _mm512_add_epi64(_mm512_slli_epi64(_mm512_popcnt_epi64(pieces[3]), 1), _mm512_slli_epi64(_mm512_popcnt_epi64(pieces[4]), 2)));
+
+        __m512i balance = _mm512_setzero_si512();
+        for(int type = PAWN; type <= QUEEN; type++) {
+            __m512i difference = _mm512_sub_epi64(_mm512_popcnt_epi64(_mm512_and_si512(pieces[type - 1], white)),
+                                                  _mm512_popcnt_epi64(_mm512_andnot_si512(white, pieces[type - 1])));
+            balance = _mm512_add_epi64(balance, _mm512_mul_epi32(difference, _mm512_set1_epi64(values[type])));
+        }
+
+        _mm256_storeu_si256((__m256i*) (material + i), _mm512_cvtepi64_epi32(balance));
+        _mm256_storeu_si256((__m256i*) (gamePhase + i), _mm512_cvtepi64_epi32(phase));
+    }
+#elif defined(__AVX2__)
+    //the lower 32 bits of every 64 bit lane
+    const __m256i narrow = _mm256_setr_epi32(0, 2, 4, 6, 0, 2, 4, 6);
+
+    for(; i + 4 <= count; i += 4) {
+        size_t index = first + i;
+        __m256i own = _mm256_loadu_si256((const __m256i*) (batch.ownPieces.data() + index));
+        __m256i pawns = _mm256_loadu_si256((const __m256i*) (batch.pawns.data() + index));
+        __m256i filesAndRanks = _mm256_loadu_si256((const __m256i*) (batch.filesAndRanks.data() + index));
+        __m256i diagonals = _mm256_loadu_si256((const __m256i*) (batch.diagonals.data() + index));
+        __m256i knights = _mm256_loadu_si256((const __m256i*) (batch.knights.data() + index));
+        __m256i kings = _mm256_loadu_si256((const __m256i*) (batch.kings.data() + index));
+
+        int32_t sideBytes;
+        std::memcpy(&sideBytes, batch.whitesTurn.data() + index, sizeof(sideBytes));
+        __m256i side = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(sideBytes));
+        __m256i whiteToMove = _mm256_cmpgt_epi64(side, _mm256_setzero_si256());
+
+        __m256i occupied = _mm256_or_si256(_mm256_or_si256(pawns, knights), _mm256_or_si256(_mm256_or_si256(filesAndRanks, diagonals), kings));
+        __m256i white = _mm256_blendv_epi8(_mm256_andnot_si256(own, occupied), own, whiteToMove);
+
+        __m256i pieces[5] = {
+            pawns,
+            knights,
+            _mm256_andnot_si256(filesAndRanks, diagonals),
+            _mm256_andnot_si256(diagonals, filesAndRanks),
+            _mm256_and_si256(filesAndRanks, diagonals)
+        };
+
+        __m256i phase = _mm256_add_epi64(popcount256(_mm256_or_si256(pieces[1], pieces[2])),
+                        _mm256_add_epi64(_mm256_slli_epi64(popcount256(pieces[3]), 1), _mm256_slli_epi64(popcount256(pieces[4]), 2)));
+
+        __m256i balance = _mm256_setzero_si256();
+        for(int type = PAWN; type <= QUEEN; type++) {
+            __m256i difference = _mm256_sub_epi64(popcount256(_mm256_and_si256(pieces[type - 1], white)),
+                                                  popcount256(_mm256_andnot_si256(white, pieces[type - 1])));
+            balance = _mm256_add_epi64(balance, _mm256_mul_epi32(difference, _mm256_set1_epi64x(values[type])));
+        }
+
+        _mm_storeu_si128((__m128i*) (material + i), _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(balance, narrow)));
+        _mm_storeu_si128((__m128i*) (gamePhase + i), _mm256_castsi256_si128(_mm256_permutevar8x32_epi32(phase, narrow)));
+    }
+#endif
+
+    //remaining positions
+    for(; i < count; i++) {
+        size_t index = first + i;
+        uint64_t occupied = batch.pawns[index] | batch.knights[index] | batch.filesAndRanks[index] | batch.diagonals[index] | batch.kings[index];
+        uint64_t white = batch.whitesTurn[index] ? batch.ownPieces[index] : occupied & ~batch.ownPieces[index];
+
+        uint64_t pieces[5] = {
+            batch.pawns[index],
+            batch.knights[index],
+            batch.diagonals[index] & ~batch.filesAndRanks[index],
+            batch.filesAndRanks[index] & ~batch.diagonals[index],
+            batch.filesAndRanks[index] & batch.diagonals[index]
+        };
+
+        gamePhase[i] = __builtin_popcountll(pieces[1] | pieces[2]) + 2 * __builtin_popcountll(pieces[3]) + 4 * __builtin_popcountll(pieces[4]);
+
+        material[i] = 0;
+        for(int type = PAWN; type <= QUEEN; type++) {
+            material[i] += values[type] * (__builtin_popcountll(pieces[type - 1] & white) - __builtin_popcountll(pieces[type - 1] & ~white));
+        }
+    }
+}
+
+/*
+    The pawn structure is computed with the vector extensions of GCC: Lanes holds the bitboards of several positions, and the
+    usual bitboard operators and Bitboard::shift work on all of them at once. Only the popcount needs intrinsics.
+    The positions that don't fill all lanes are computed by the same code with plain bitboards
+*/
+#if defined(__AVX512F__) && defined(__AVX512VPOPCNTDQ__)
+    typedef uint64_t Lanes __attribute__((vector_size(64)));
+
+    static inline Lanes popcount(Lanes board) {
+        return (Lanes) _mm512_popcnt_epi64((__m512i) board);
+    }
+#elif defined(__AVX2__)
+    typedef uint64_t Lanes __attribute__((vector_size(32)));
+
+    static inline Lanes popcount(Lanes board) {
+        return (Lanes) popcount256((__m256i) board);
+    }
+#endif
+
+#if defined(__AVX2__)
+    static inline uint64_t getLane(Lanes board, int lane) {
+        return board[lane];
+    }
+#endif
+
+static inline uint64_t popcount(uint64_t board) {
+    return __builtin_popcountll(board);
+}
+
+static inline uint64_t getLane(uint64_t board, int) {
+    return board;
+}
+
+//loads the bitboards of consecutive positions
+template<typename Board>
+static inline Board load(const uint64_t *boards) {
+    Board board;
+    std::memcpy(&board, boards, sizeof(Board));
+    return board;
+}
+
+/**
+ * the pawn structure terms of one color, as computed by Eval::evaluatePawnStructure().
+ * Passed pawns are counted per rank instead of looked up per pawn, so that no lane has to be handled on its own
+ * @returns the packed ScorePair value of the terms in the low 32 bits
+ */
+template<char color, typename Board>
+static Board evaluatePawnStructure(Board ourPawns, Board enemyPawns, Board& attackedByPawn, Board& enemyOutpostSquares, Board& blockedPawns) {
+    const Eval::Params *params = Eval::params;
+
+    Board squaresInFrontOfPawns;
+    Board pawnFiles;
+    if(color == WHITE) {
+        attackedByPawn = shift<NORTH_EAST>(ourPawns) | shift<NORTH_WEST>(ourPawns);
+        blockedPawns = shift<SOUTH>(enemyPawns) & ourPawns;
+
+        squaresInFrontOfPawns = ourPawns >> 8;
+        squaresInFrontOfPawns |= squaresInFrontOfPawns >> 8;
+        squaresInFrontOfPawns |= squaresInFrontOfPawns >> 16;
+        squaresInFrontOfPawns |= squaresInFrontOfPawns >> 32;
+        pawnFiles = squaresInFrontOfPawns & (uint64_t) 0xff;
+    } else {
+        attackedByPawn = shift<SOUTH_EAST>(ourPawns) | shift<SOUTH_WEST>(ourPawns);
+        blockedPawns = shift<NORTH>(enemyPawns) & ourPawns;
+
+        squaresInFrontOfPawns = ourPawns << 8;
+        squaresInFrontOfPawns |= squaresInFrontOfPawns << 8;
+        squaresInFrontOfPawns |= squaresInFrontOfPawns << 16;
+        squaresInFrontOfPawns |= squaresInFrontOfPawns << 32;
+        pawnFiles = squaresInFrontOfPawns >> 56;
+    }
+
+    Board adjacentFiles = shift<WEST>(squaresInFrontOfPawns) | shift<EAST>(squaresInFrontOfPawns);
+    enemyOutpostSquares = ~adjacentFiles;
+
+    Board stackedPawns = squaresInFrontOfPawns & ourPawns;
+    Board stackedPawnFiles = stackedPawns | (stackedPawns >> 8);
+    stackedPawnFiles |= stackedPawnFiles >> 16;
+    stackedPawnFiles |= stackedPawnFiles >> 32;
+
+    Board isolatedPawnFiles = pawnFiles & ~(pawnFiles << 1) & ~(pawnFiles >> 1) & ~stackedPawnFiles;
+
+    Board score = popcount(stackedPawns) * (uint64_t) params->stackedPawns.getValue()
+                + popcount(isolatedPawnFiles) * (uint64_t) params->isolatedPawns.getValue();
+
+    //enemy passed pawns, subtracted from the score
+    Board enemyPassedPawns = enemyPawns & ~(squaresInFrontOfPawns | adjacentFiles);
+    for(int rank = 1; rank <= 6; rank++) {
+        int row = color == WHITE ? rank : 7 - rank; //the rank is counted from the side of the enemy
+        score -= popcount(enemyPassedPawns & (((uint64_t) 0xff) << (8 * row))) * (uint64_t) params->passedPawns[rank - 1].getValue();
+    }
+
+    return score;
+}
+
+//computes the pawn structure of as many consecutive positions as a Board holds bitboards
+template<typename Board>
+static void evaluatePawnLanes(const BatchEval::PositionBatch& batch, size_t index, PawnStructure *pawnStructures) {
+    const int numOfLanes = sizeof(Board) / sizeof(uint64_t);
+
+    uint64_t whiteToMoveMasks[numOfLanes];
+    for(int lane = 0; lane < numOfLanes; lane++) {
+        whiteToMoveMasks[lane] = batch.whitesTurn[index + lane] ? ~((uint64_t) 0) : 0;
+    }
+    Board whiteToMove = load<Board>(whiteToMoveMasks);
+
+    Board own = load<Board>(batch.ownPieces.data() + index);
+    Board pawns = load<Board>(batch.pawns.data() + index);
+    Board occupied = pawns | load<Board>(batch.knights.data() + index) | load<Board>(batch.filesAndRanks.data() + index)
+                   | load<Board>(batch.diagonals.data() + index) | load<Board>(batch.kings.data() + index);
+    Board white = (own & whiteToMove) | (occupied & ~own & ~whiteToMove);
+
+    Board attackedByPawn[2];
+    Board potentialOutpostSquares[2];
+    Board blockedPawns[2];
+    Board score = evaluatePawnStructure<WHITE>(pawns & white, pawns & ~white, attackedByPawn[WHITE], potentialOutpostSquares[BLACK], blockedPawns[WHITE])
+                - evaluatePawnStructure<BLACK>(pawns & ~white, pawns & white, attackedByPawn[BLACK], potentialOutpostSquares[WHITE], blockedPawns[BLACK]);
+
+    for(int lane = 0; lane < numOfLanes; lane++) {
+        PawnStructure& pawnStructure = pawnStructures[lane];
+        for(int color = WHITE; color <= BLACK; color++) {
+            pawnStructure.attackedByPawn[color] = getLane(attackedByPawn[color], lane);
+            pawnStructure.potentialOutpostSquares[color] = getLane(potentialOutpostSquares[color], lane);
+            pawnStructure.blockedPawns[color] = getLane(blockedPawns[color], lane);
+        }
+        pawnStructure.score = ScorePair::fromValue((uint32_t) getLane(score, lane));
+    }
+}
+
+void BatchEval::evaluatePawns(const PositionBatch& batch, size_t first, int count, PawnStructure *pawnStructures) {
+    int i = 0;
+
+#if defined(__AVX2__)
+    const int numOfLanes = sizeof(Lanes) / sizeof(uint64_t);
+    for(; i + numOfLanes <= count; i += numOfLanes) {
+        evaluatePawnLanes<Lanes>(batch, first + i, pawnStructures + i);
+    }
+#endif
+
+    //remaining positions
+    for(; i < count; i++) {
+        evaluatePawnLanes<uint64_t>(batch, first + i, pawnStructures + i);
+    }
+}
+
+void BatchEval::evaluate(const PositionBatch& batch, short *scores) {
+    int32_t material[chunkSize];
+    int32_t gamePhase[chunkSize];
+    PawnStructure pawnStructures[chunkSize];
+
+    //only the fields used by the evaluation are set. The hash and the castling and en passant state are meaningless
+    Game::Position pos;
+
+    for(size_t first = 0; first < batch.size(); first += chunkSize) {
+        int count = std::min((size_t) chunkSize, batch.size() - first);
+        evaluateMaterial(batch, first, count, material, gamePhase);
+        evaluatePawns(batch, first, count, pawnStructures);
+
+        for(int i = 0; i < count; i++) {
+            size_t index = first + i;
+            pos.ownPieces = batch.ownPieces[index];
+            pos.pawns = batch.pawns[index];
+            pos.filesAndRanks = batch.filesAndRanks[index];
+            pos.diagonals = batch.diagonals[index];
+            pos.knights = batch.knights[index];
+            pos.kings = batch.kings[index];
+            pos.whitesTurn = batch.whitesTurn[index];
+
+            uint64_t occupied = pos.pawns | pos.knights | pos.filesAndRanks | pos.diagonals | pos.kings;
+            uint64_t white = pos.whitesTurn ? pos.ownPieces : occupied & ~pos.ownPieces;
+
+            uint64_t pieces[6] = {
+                pos.pawns,
+                pos.knights,
+                pos.diagonals & ~pos.filesAndRanks,
+                pos.filesAndRanks & ~pos.diagonals,
+                pos.filesAndRanks & pos.diagonals,
+                pos.kings
+            };
+
+            //the piece-square values need a table lookup per piece
+            ScorePair psqtScore = ScorePair(material[i]);
+            for(int type = PAWN; type <= KING; type++) {
+                foreach(pieces[type - 1], [&](char square) {
+                    psqtScore += Eval::getPieceSquareScore(type, square, !(getBitboard(square) & white));
+                });
+            }
+
+            pos.psqtScore = psqtScore;
+            pos.gamePhase = gamePhase[i];
+
+            scores[index] = Eval::evaluate(&pos, pawnStructures[i]);
+        }
+    }
+}
@@ -0,0 +1,56 @@
+#ifndef BATCHEVAL_H
+#define BATCHEVAL_H
+
+#include <cstdint>
+#include <vector>
+
+#include "game.h"
+#include "eval.h"
+
+/**
+ * static evaluation of many independent positions, for tuning and labelling data sets.
+ * Positions are stored as arrays of their bitboards. The terms that only need bitboard arithmetic and popcounts
+ * (the split into colors, material balance, game phase and the pawn structure) are computed for several positions at once
+ * with AVX-512 or AVX2 if available. The piece-square values and the piece terms (mobility, king safety, outposts)
+ * are computed per position by the hand-crafted evaluation, which takes the precomputed pawn structure
+ */
+class BatchEval {
+    public:
+
+        /**
+         * positions as a structure of arrays. Element i of every array belongs to position i
+         */
+        struct PositionBatch {
+            std::vector<uint64_t> ownPieces;
+            std::vector<uint64_t> pawns;
+            std::vector<uint64_t> filesAndRanks;
+            std::vector<uint64_t> diagonals;
+            std::vector<uint64_t> knights;
+            std::vector<uint64_t> kings;
+            std::vector<uint8_t> whitesTurn;
+
+            void add(const Game::Position& pos);
+
+            void clear();
+
+            size_t size() const;
+        };
+
+        /**
+         * evaluates all positions of the batch
+         * @param scores is used to return the evaluations, from the view of the side to move. Must have space for batch.size() values
+         */
+        static void evaluate(const PositionBatch& batch, short *scores);
+
+    private:
+        //number of positions whose vectorized terms are computed before the remaining terms are evaluated
+        static const int chunkSize = 64;
+
+        //computes the material balance (from whites perspective) and the game phase of the positions [first, first + count)
+        static void evaluateMaterial(const PositionBatch& batch, size_t first, int count, int32_t *material, int32_t *gamePhase);
+
+        //computes the pawn structure of the positions [first, first + count)
+        static void evaluatePawns(const PositionBatch& batch, size_t first, int count, PawnStructure *pawnStructures);
+};
+
+#endif
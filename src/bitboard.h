@@ -8,6 +8,11 @@
 
 #include "constants.h"
 
+#if defined(__BMI2__) && !defined(NO_PEXT)
+    #define USE_PEXT
+    #include <immintrin.h>
+#endif
+
 namespace Bitboard {
 
 
@@ -167,7 +172,8 @@ namespace Bitboard {
         return pawnAttacksLUT[square][blackPawn];
     }
 
-    //shifts the whole bitboard in the given direction. Squares on the new edges are filled with zero
+    //shifts the whole bitboard in the given direction. Squares on the new edges are filled with zero.
+    //The board may also be a vector of bitboards (see BatchEval), then every element is shifted
     /*
         0 0 1 1 1 0 0 1
         0 0 0 0 0 0 0 1
@@ -190,8 +196,8 @@ namespace Bitboard {
         0 0 0 0 0 0 0 0
 
     */
-    template<char direction>
-    inline uint64_t shift(uint64_t square) {
+    template<char direction, typename Board>
+    inline Board shift(Board square) {
         if(direction == NORTH) {
             return square >> 8;
         } else if(direction == NORTH_EAST) {
@@ -261,6 +267,140 @@ namespace Bitboard {
         }
     }
 
+    //slow reference implementation for sliding attacks, only used to fill the attack tables below
+    template<bool bishop>
+    uint64_t getSlidingAttacksSlow(char square, uint64_t occ) {
+        if(bishop) {
+            return getBlockedRay<NORTH_EAST, true>(square, occ) | getBlockedRay<SOUTH_EAST, true>(square, occ)
+                 | getBlockedRay<SOUTH_WEST, true>(square, occ) | getBlockedRay<NORTH_WEST, true>(square, occ);
+        } else {
+            return getBlockedRay<NORTH, true>(square, occ) | getBlockedRay<EAST, true>(square, occ)
+                 | getBlockedRay<SOUTH, true>(square, occ) | getBlockedRay<WEST, true>(square, occ);
+        }
+    }
+
+
+    /*
+        magic bitboards:
+        every square has a mask of the squares whose occupancy influences the attacks of a slider on that square (edge squares don't matter).
+        The masked occupancy is mapped to an index into the attack table of that square, either by a multiplication with a magic number
+        followed by a shift, or, if the cpu supports BMI2, by a single pext instruction. Compile with -DNO_PEXT to force the magic
+        multiplication, which is faster on cpus with a slow pext implementation.
+    */
+
+    struct Magic {
+        uint64_t mask;
+        uint64_t magic;
+        uint64_t *attacks;
+        unsigned int shift;
+
+        inline unsigned int index(uint64_t occ) const {
+            #ifdef USE_PEXT
+                return _pext_u64(occ, mask);
+            #else
+                return ((occ & mask) * magic) >> shift;
+            #endif
+        }
+    };
+
+    inline Magic bishopMagics[64];
+    inline Magic rookMagics[64];
+
+    //the number of entries is the sum of 2^(number of relevant occupancy squares) over all squares
+    inline uint64_t bishopAttackTable[5248];
+    inline uint64_t rookAttackTable[102400];
+
+    //searches magic numbers for every square and fills the attack tables
+    template<bool bishop>
+    void initMagics(Magic *magics, uint64_t *table) {
+        const uint64_t rank1And8 = ((uint64_t) 0xff) | (((uint64_t) 0xff) << 56);
+        const uint64_t fileAAndH = ((uint64_t) 0x0101010101010101) | ((uint64_t) 0x8080808080808080);
+
+        #ifndef USE_PEXT
+            uint64_t occupancies[4096];
+            uint64_t references[4096];
+            int epoch[4096] = {};
+            int currentEpoch = 0;
+
+            uint64_t prngState = 0x9e3779b97f4a7c15;
+            auto random = [&]() {
+                prngState ^= prngState >> 12;
+                prngState ^= prngState << 25;
+                prngState ^= prngState >> 27;
+                return prngState * 2685821657736338717;
+            };
+        #endif
+
+        uint64_t *attacks = table;
+
+        for(int square = 0; square < 64; square++) {
+            Magic& m = magics[square];
+
+            uint64_t edges = (rank1And8 & ~(((uint64_t) 0xff) << (square & 0xf8))) | (fileAAndH & ~(((uint64_t) 0x0101010101010101) << (square % 8)));
+            m.mask = getSlidingAttacksSlow<bishop>(square, 0) & ~edges;
+            m.shift = 64 - __builtin_popcountll(m.mask);
+            m.attacks = attacks;
+
+            //enumerate all subsets of the mask (carry rippler)
+            int size = 0;
+            uint64_t occ = 0;
+            do {
+                #ifdef USE_PEXT
+                    m.attacks[_pext_u64(occ, m.mask)] = getSlidingAttacksSlow<bishop>(square, occ);
+                #else
+                    occupancies[size] = occ;
+                    references[size] = getSlidingAttacksSlow<bishop>(square, occ);
+                #endif
+
+                size++;
+                occ = (occ - m.mask) & m.mask;
+            } while(occ);
+
+            attacks += size;
+
+            #ifndef USE_PEXT
+                //try sparse random numbers until one maps every occupancy to an index without destructive collisions
+                bool found = false;
+                while(!found) {
+                    do {
+                        m.magic = random() & random() & random();
+                    } while(__builtin_popcountll((m.magic * m.mask) >> 56) < 6);
+
+                    currentEpoch++;
+                    found = true;
+                    for(int i = 0; i < size; i++) {
+                        unsigned int index = m.index(occupancies[i]);
+                        if(epoch[index] < currentEpoch) {
+                            epoch[index] = currentEpoch;
+                            m.attacks[index] = references[i];
+                        } else if(m.attacks[index] != references[i]) {
+                            found = false;
+                            break;
+                        }
+                    }
+                }
+            #endif
+        }
+    }
+
+    inline const bool slidingAttacksInitialized = []() {
+        initMagics<true>(bishopMagics, bishopAttackTable);
+        initMagics<false>(rookMagics, rookAttackTable);
+        return true;
+    }();
+
+    //returns all squares attacked by a bishop on the given square, including the first blocker in every direction
+    inline uint64_t getBishopAttacks(char square, uint64_t occ) {
+        const Magic& m = bishopMagics[square];
+        return m.attacks[m.index(occ)];
+    }
+
+    //returns all squares attacked by a rook on the given square, including the first blocker in every direction
+    inline uint64_t getRookAttacks(char square, uint64_t occ) {
+        const Magic& m = rookMagics[square];
+        return m.attacks[m.index(occ)];
+    }
+
     void inline printBitBoard(uint64_t board) {
         for(int i = 0; i < 8; i++) {
             for(int j = 0; j < 8; j++) {
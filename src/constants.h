@@ -25,6 +25,12 @@ const char NORTH_WEST = 7;
 const std::string START_POSITION_FEN = "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1";
 
 
+//move types for the move generation
+const char ALL_MOVES = 0;
+const char CAPTURES = 1; //captures including en passant and capturing promotions
+const char QUIET_MOVES = 2; //moves to empty squares, including non capturing promotions and castling
+
+
 const char WHITE = 0;
 const char BLACK = 1;
 
@@ -5,6 +5,8 @@
 #include <cctype>
 #include <condition_variable>
 #include <vector>
+#include <cmath>
+#include <algorithm>
 
 
 #include "engine.h"
@@ -13,17 +15,39 @@
 #include "ttable.h"
 #include "move.h"
 #include "eval.h"
+#include "nnue.h"
+#include "movepicker.h"
+#include "evalcache.h"
 
 std::atomic<bool> Engine::stop;
 std::atomic<bool> Engine::ponder;
+std::atomic<bool> Engine::helpersStop;
+int Engine::numThreads = 1;
+Engine::SearchStats Engine::searchStats[Engine::maxThreads];
 Engine::Options Engine::options;
-bool Engine::searchAborted;
-uint64_t Engine::nodesSearched;
 std::atomic<uint64_t> Engine::maxTimeInms;
-Game Engine::game;
+Game Engine::rootGame;
 std::chrono::time_point<std::chrono::steady_clock> Engine::executionStartTime;
 std::thread Engine::workerThread;
-Move (*Engine::killerMoves)[2];
+std::vector<std::thread> Engine::helperThreads;
+
+int Engine::lmrBase = 75;
+int Engine::lmrDivisor = 225;
+int Engine::reductions[64][64];
+
+thread_local int Engine::threadIndex;
+thread_local std::atomic<bool> *Engine::stopSignal;
+thread_local bool Engine::searchAborted;
+thread_local Game *Engine::game;
+thread_local Move Engine::rootBestMove;
+thread_local Move (*Engine::killerMoves)[2];
+thread_local Move *Engine::moveStack;
+Engine::OrderingTables *Engine::orderingTables[Engine::maxThreads];
+thread_local Engine::OrderingTables *Engine::ordering;
+PawnTable *Engine::pawnTables[Engine::maxThreads];
+int Engine::pawnTableSize = 1;
+bool Engine::useNNUE = false;
+int Engine::lazyEvalMargin = 600;
 
 std::thread Engine::timeController;
 std::mutex Engine::timeThreadMutex;
@@ -108,7 +132,7 @@ void Engine::startAnalyzing(Game& game, Engine::Options& options) {
     Engine::ponder = options.ponder;
     Engine::executionStartTime = std::chrono::steady_clock::now();
     Engine::playAsWhite = game.pos->whitesTurn;
-    Engine::game = game;
+    Engine::rootGame = game;
     Engine::options = options;
 
     //if necessary, start timer
@@ -120,6 +144,185 @@ void Engine::startAnalyzing(Game& game, Engine::Options& options) {
     Engine::workerThread = std::thread(&analyze);
 }
 
+void Engine::setNumThreads(int threads) {
+    if(threads < 1)
+        threads = 1;
+    if(threads > maxThreads)
+        threads = maxThreads;
+    Engine::numThreads = threads;
+}
+
+void Engine::setLMRParameters(int base, int divisor) {
+    Engine::lmrBase = base;
+    Engine::lmrDivisor = divisor;
+
+    for(int depth = 0; depth < 64; depth++) {
+        for(int moveNumber = 0; moveNumber < 64; moveNumber++) {
+            if(depth == 0 || moveNumber == 0) {
+                reductions[depth][moveNumber] = 0;
+            } else {
+                reductions[depth][moveNumber] = (int) (base / 100.0 + std::log(depth) * std::log(moveNumber) / (divisor / 100.0));
+            }
+        }
+    }
+}
+
+void Engine::count(std::atomic<uint64_t> SearchStats::*counter) {
+    //only this thread writes its counters, so there is no need for an atomic read-modify-write
+    std::atomic<uint64_t>& value = searchStats[threadIndex].*counter;
+    value.store(value.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+void Engine::countNode() {
+    count(&SearchStats::nodes);
+}
+
+uint64_t Engine::getStatsSum(std::atomic<uint64_t> SearchStats::*counter) {
+    uint64_t sum = 0;
+    for(int i = 0; i < numThreads; i++) {
+        sum += (searchStats[i].*counter).load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+uint64_t Engine::getNodeCount() {
+    return getStatsSum(&SearchStats::nodes);
+}
+
+bool Engine::nodeLimitReached() {
+    if(options.maxNodes == -1)
+        return false;
+
+    //with a single thread the own counter is the total
+    uint64_t nodes = searchStats[threadIndex].nodes.load(std::memory_order_relaxed);
+    if(numThreads == 1)
+        return nodes > (uint64_t) options.maxNodes;
+
+    //summing the counters reads the cache lines of all other threads, so it is only done every few nodes
+    return (nodes & (nodeLimitCheckInterval - 1)) == 0 && getNodeCount() > (uint64_t) options.maxNodes;
+}
+
+short Engine::getStaticEval(short& staticEval) {
+    if(staticEval != TTable::noStaticEval)
+        return staticEval;
+
+    uint64_t positionHash = game->pos->getPositionHash();
+    if(EvalCache::lookup(positionHash, staticEval)) {
+        count(&SearchStats::evalCacheHits);
+        return staticEval;
+    }
+
+    count(&SearchStats::evaluations);
+    staticEval = useNNUE ? NNUE::evaluate(game) : Eval::evaluate(game->pos, pawnTables[threadIndex]);
+    EvalCache::insert(positionHash, staticEval);
+    return staticEval;
+}
+
+short Engine::getLazyStaticEval(short alpha, short beta) {
+    short staticEval = TTable::noStaticEval;
+
+    //the neural network has no cheap part to stop after
+    if(useNNUE || lazyEvalMargin >= maxLazyEvalMargin)
+        return getStaticEval(staticEval);
+
+    uint64_t positionHash = game->pos->getPositionHash();
+    if(EvalCache::lookup(positionHash, staticEval)) {
+        count(&SearchStats::evalCacheHits);
+        return staticEval;
+    }
+
+    count(&SearchStats::evaluations);
+    bool complete;
+    short eval = Eval::evaluate(game->pos, pawnTables[threadIndex], alpha - lazyEvalMargin, beta + lazyEvalMargin, complete);
+    if(complete) {
+        EvalCache::insert(positionHash, eval);
+    } else {
+        count(&SearchStats::lazyEvals);
+    }
+    return eval;
+}
+
+void Engine::startHelpers() {
+    helpersStop = false;
+    for(int i = 1; i < numThreads; i++) {
+        helperThreads.push_back(std::thread(&helperSearch, i));
+    }
+}
+
+void Engine::stopHelpers() {
+    helpersStop = true;
+    for(std::thread& helper : helperThreads) {
+        helper.join();
+    }
+    helperThreads.clear();
+}
+
+void Engine::prepareOrderingTables() {
+    if(orderingTables[threadIndex] == nullptr) {
+        orderingTables[threadIndex] = (OrderingTables *) calloc(1, sizeof(OrderingTables));
+    } else {
+        //the statistics of the previous search are still useful, but should not outweigh the new ones
+        short (*history)[64] = orderingTables[threadIndex]->history[0];
+        for(int i = 0; i < 2 * 64; i++) {
+            for(int j = 0; j < 64; j++) {
+                history[i][j] /= 2;
+            }
+        }
+    }
+    ordering = orderingTables[threadIndex];
+}
+
+void Engine::setPawnTableSize(int sizeInMiB) {
+    pawnTableSize = sizeInMiB;
+}
+
+void Engine::setUseNNUE(bool useNNUE) {
+    //without a network the hand-crafted evaluation is used
+    useNNUE = useNNUE && NNUE::isLoaded();
+
+    if(useNNUE != Engine::useNNUE) {
+        EvalCache::clear();
+        TTable::invalidateStaticEvals();
+    }
+    Engine::useNNUE = useNNUE;
+}
+
+void Engine::setLazyEvalMargin(int margin) {
+    lazyEvalMargin = margin;
+}
+
+void Engine::preparePawnTable() {
+    if(pawnTables[threadIndex] != nullptr && pawnTables[threadIndex]->getSizeInMiB() != pawnTableSize) {
+        delete pawnTables[threadIndex];
+        pawnTables[threadIndex] = nullptr;
+    }
+
+    if(pawnTables[threadIndex] == nullptr) {
+        pawnTables[threadIndex] = new PawnTable(pawnTableSize);
+    }
+}
+
+void Engine::updateHistory(short& entry, int bonus) {
+    entry += bonus - entry * std::abs(bonus) / maxHistory;
+}
+
+void Engine::helperSearch(int index) {
+    Game threadGame = rootGame;
+    game = &threadGame;
+    threadIndex = index;
+    stopSignal = &helpersStop;
+    prepareOrderingTables();
+    preparePawnTable();
+
+    //helpers with an odd index start one ply deeper, so that not all threads search the same depth at the same time
+    for(int depth = 1 + (index & 1); depth < maxSearchDepth; depth++) {
+        searchAborted = false;
+        searchWrapper(depth);
+        if(searchAborted)
+            break;
+    }
+}
+
 bool Engine::isMate(short evaluation) {
     return (evaluation > ((32767-maxMateDistance) + 1)) || (evaluation < ((-32767 + maxMateDistance) - 1));
 }
@@ -127,6 +330,21 @@ bool Engine::isMate(short evaluation) {
 
 void Engine::analyze() {
 
+    Game threadGame = rootGame;
+    game = &threadGame;
+    threadIndex = 0;
+    stopSignal = &stop;
+    prepareOrderingTables();
+    preparePawnTable();
+
+    for(int i = 0; i < numThreads; i++) {
+        searchStats[i].nodes = 0;
+        searchStats[i].evaluations = 0;
+        searchStats[i].evalCacheHits = 0;
+        searchStats[i].ttEvalHits = 0;
+        searchStats[i].lazyEvals = 0;
+    }
+
     uint64_t lastDepthSearchTime = 0;
 
     Move lastPV[Engine::maxPVLength];
@@ -134,7 +352,7 @@ void Engine::analyze() {
 
     //save time in positions with only one legal move
     Move buffer[343];
-    int numOfMoves = game.pos->getLegalMoves(buffer);
+    int numOfMoves = game->pos->getLegalMoves(buffer);
     if(numOfMoves == 1) {
         lastPV[0] = buffer[0];
         lastpvLength = 1;
@@ -142,8 +360,14 @@ void Engine::analyze() {
     } else {
         
         int searchDepth = 1;
+        short lastEvaluation = 0;
 
-        TTable::clear();
+        rootBestMove = buffer[0];
+
+        //the table is kept between searches, entries of earlier searches are replaced first
+        TTable::newSearch();
+
+        startHelpers();
 
         while(true) {
 
@@ -151,36 +375,81 @@ void Engine::analyze() {
 
             searchAborted = false;
 
-            Engine::nodesSearched = 0;
+            uint64_t nodesAtDepthStart = getNodeCount();
 
-            short currentEvaluation = searchWrapper(searchDepth);
+            short currentEvaluation;
+
+            if(searchDepth < aspirationMinDepth || isMate(lastEvaluation)) {
+                currentEvaluation = searchWrapper(searchDepth);
+            } else {
+                int delta = aspirationWindow;
+                short alpha = std::max(lastEvaluation - delta, -32767);
+                short beta = std::min(lastEvaluation + delta, 32767);
+
+                while(true) {
+                    currentEvaluation = searchWrapper(searchDepth, alpha, beta);
+
+                    if(searchAborted || (currentEvaluation > alpha && currentEvaluation < beta)) {
+                        break;
+                    }
+
+                    //the score is only a bound, tell the gui and search again with a wider window
+                    ioLock.lock();
+                    std::cout << "info depth " << searchDepth;
+                    if(isMate(currentEvaluation)) {
+                        std::cout << " score mate " << getMateDistanceFromEvaluation(currentEvaluation);
+                    } else {
+                        std::cout << " score cp " << currentEvaluation;
+                    }
+                    std::cout << (currentEvaluation <= alpha ? " upperbound" : " lowerbound")
+                              << " nodes " << getNodeCount() - nodesAtDepthStart
+                              << " time " << std::chrono::duration_cast<std::chrono::milliseconds>(
+                                        std::chrono::steady_clock::now() - depthStartTime).count() << std::endl;
+                    ioLock.unlock();
+
+                    delta *= 2;
+                    if(delta > aspirationMaxWindow) {
+                        alpha = -32767;
+                        beta = 32767;
+                    } else if(currentEvaluation <= alpha) {
+                        alpha = std::max(currentEvaluation - delta, -32767);
+                    } else {
+                        beta = std::min(currentEvaluation + delta, 32767);
+                    }
+                }
+            }
 
             if(searchAborted) {
                 searchDepth --;
                 break;
             }
             
-            //extract the pv from the transposition table
-            lastpvLength = 0;
+            //the best root move is taken from the search itself, as helper threads may already have overwritten the root entry
+            //in the transposition table. The rest of the pv is extracted from the table
+            lastPV[0] = rootBestMove;
+            lastpvLength = 1;
+            game->makeMove(rootBestMove);
             
-            for(int i = 0; i < Engine::maxPVLength && i < searchDepth; i++) {
-                if(game.isPositionDraw(i)) {
+            for(int i = 1; i < Engine::maxPVLength && i < searchDepth; i++) {
+                if(game->isPositionDraw(i)) {
                     break;
                 }
-                uint64_t positionHash = game.pos->getPositionHash();
-                TTable::Entry* ttentry = TTable::lookup(positionHash);
-                if(ttentry != nullptr && ttentry->depth == searchDepth - i && ttentry->entryType == 1) {
-                    lastPV[i] = Move(ttentry->move);
+                uint64_t positionHash = game->pos->getPositionHash();
+                TTable::Entry ttentry;
+                if(TTable::lookup(positionHash, ttentry) && ttentry.depth >= searchDepth - i && ttentry.entryType == 1 && game->pos->moveLegal(Move(ttentry.move))) {
+                    lastPV[i] = Move(ttentry.move);
                     lastpvLength ++;
-                    game.makeMove(Move(ttentry->move));
+                    game->makeMove(Move(ttentry.move));
                 } else {
                     break;
                 }
             }
             for(int i = 0; i < lastpvLength; i++) {
-                game.undo();
+                game->undo();
             }
 
+            uint64_t nodesSearched = getNodeCount() - nodesAtDepthStart;
+
             uint64_t currentDepthSearchTime = std::chrono::duration_cast<std::chrono::milliseconds>(
                     std::chrono::steady_clock::now() - depthStartTime).count();
 
@@ -193,7 +462,7 @@ void Engine::analyze() {
                 std::cout << " score cp " << currentEvaluation;
             }
                         
-            std::cout   << " nodes " << Engine::nodesSearched 
+            std::cout   << " nodes " << nodesSearched 
                         << " time " << currentDepthSearchTime;
 
             if(currentDepthSearchTime > 10) //only send nps when the time precision is sufficient
@@ -215,6 +484,10 @@ void Engine::analyze() {
                 break;
             }
 
+            if(searchDepth >= maxSearchDepth) {
+                break;
+            }
+
             if(options.moveTime == -1 && options.movesToGo != 1 && !options.searchInfinitely && (Engine::playAsWhite ? options.wtime : options.btime) != -1 && !Engine::ponder && lastDepthSearchTime >= 100) {
                 if(((double) currentDepthSearchTime) / ((double) lastDepthSearchTime) * 1.5 * ((double) currentDepthSearchTime) + getExecutionTimeInms() >= Engine::maxTimeInms) {
                     //as it is quite possible that we won't finish the search of the next depth we abort, to not waste time
@@ -222,13 +495,27 @@ void Engine::analyze() {
                 }
             }
             lastDepthSearchTime = currentDepthSearchTime;
+            lastEvaluation = currentEvaluation;
     
             searchDepth++;
         }
+
+        stopHelpers();
     }
     
     ioLock.lock();
 
+    //how often the static evaluation had to be computed
+    uint64_t nodes = getNodeCount();
+    uint64_t evaluations = getStatsSum(&SearchStats::evaluations);
+    std::cout << "info string evaluations " << evaluations
+              << " evalcachehits " << getStatsSum(&SearchStats::evalCacheHits)
+              << " ttevalhits " << getStatsSum(&SearchStats::ttEvalHits)
+              << " lazyevals " << getStatsSum(&SearchStats::lazyEvals);
+    if(nodes > 0)
+        std::cout << " evaluationspernode " << ((double) evaluations) / ((double) nodes);
+    std::cout << std::endl;
+
     //when interrupted during the first search depth, choose a random move.
     if(lastpvLength == 0) {
         lastPV[0] = buffer[0];
@@ -259,24 +546,17 @@ short Engine::getMateDistanceFromEvaluation(int eval) {
     }
 }
 
-int Engine::getMVV_LVA_eval(Game::Position* pos, Move move) {
-    int values[6] = {1,1,3,3,5,9};
-    char victim = pos->getPieceOnSquare(move.to);
-    char aggressor = pos->getPieceOnSquare(move.from);
-    return 10*victim-aggressor;
-}
-
 int Engine::sortCaptures(Game::Position* pos, Move *moveBuffer, int numOfMoves) {
     
     int numOfCaptures = 0;
-    static int moveOrderEval[343];
+    int moveOrderEval[343];
 
     for(int i = 0; i < numOfMoves; i++) {
         if(!pos->isCapture(moveBuffer[i])) {
             continue;
         }
 
-        int priority = getMVV_LVA_eval(pos, moveBuffer[i]);
+        int priority = MovePicker::getMVV_LVA_eval(pos, moveBuffer[i]);
         Move captureMove = moveBuffer[i];
 
         moveBuffer[i] = moveBuffer[numOfCaptures];
@@ -298,19 +578,21 @@ int Engine::sortCaptures(Game::Position* pos, Move *moveBuffer, int numOfMoves)
     return numOfCaptures;
 }
 
-short Engine::searchWrapper(int depth) {
+short Engine::searchWrapper(int depth, short alpha, short beta) {
     //initialize killer move array
-    killerMoves = (Move (*)[2]) malloc(sizeof(Move) * (343 * (depth + 1) + 30 * 64) * 2);
-    for(int i = 0; i < depth+1; i++) {
+    killerMoves = (Move (*)[2]) malloc(sizeof(Move) * Game::maxSearchPly * 2);
+    for(int i = 0; i < Game::maxSearchPly; i++) {
         killerMoves[i][0] = Move(0, 0);
         killerMoves[i][1] = Move(0, 0);
     }
+    moveStack = (Move *) malloc(sizeof(Move) * Game::maxSearchPly);
 
     Move *moveBuffer = (Move *) malloc(sizeof(Move) * (343 * (depth + 1) + 30 * 64));
 
-    short result = search(-32767, 32767, depth, 0, true, moveBuffer);
+    short result = search(alpha, beta, depth, 0, true, moveBuffer, true);
 
     free(killerMoves);
+    free(moveStack);
     free(moveBuffer);
 
     return result;
@@ -323,7 +605,7 @@ short Engine::searchWrapper(int depth) {
  * if beta <= exact score: beta <= return value <= exact score
 */
 
-short Engine::search(short alpha, short beta, int depth, int distanceToRoot, bool pvNode, Move *moveBuffer) {
+short Engine::search(short alpha, short beta, int depth, int distanceToRoot, bool pvNode, Move *moveBuffer, bool nullMoveAllowed) {
 
     if(depth == 0) {
         return qsearch(alpha, beta, distanceToRoot, pvNode, moveBuffer);
@@ -331,30 +613,19 @@ short Engine::search(short alpha, short beta, int depth, int distanceToRoot, boo
 
     short oldAlpha = alpha;
 
-    nodesSearched ++;
+    countNode();
 
-    if(options.maxNodes && nodesSearched > options.maxNodes) { 
+    if(nodeLimitReached()) {
         searchAborted = true;
         return 0;
     }
 
-    if(Engine::stop) {
+    if(*stopSignal) {
         searchAborted = true;
         return 0;
     }
 
-    int numOfMoves;
-    bool kingInCheck;
-    numOfMoves = game.pos->getLegalMoves(kingInCheck, moveBuffer);
-
-
-    if(numOfMoves == 0) {
-        if(kingInCheck) {
-            return getMateEvaluation(distanceToRoot);
-        } else {
-            return 0;
-        }
-    }
+    bool kingInCheck = game->pos->ownKingInCheck();
 
     //mate distance pruning
     if(!pvNode) {
@@ -369,66 +640,75 @@ short Engine::search(short alpha, short beta, int depth, int distanceToRoot, boo
         }
     }
 
-    if(game.isPositionDraw(distanceToRoot)) {
+    if(game->isPositionDraw(distanceToRoot)) {
         return 0;
     }
 
-    if(distanceToRoot == 0) {
-        //check if options.searchmoves contains moves to be searched exclusively. If not search all legal moves (which are computed above)
-        if(options.searchMoves.size() != 0) {
-            for(int i = 0; i < options.searchMoves.size(); i++) {
-                moveBuffer[i] = options.searchMoves[i];
-            } 
-            numOfMoves = options.searchMoves.size();
-        }
-    }
-
     Move bestMove;
+    Move ttMove = Move(0, 0);
+    short staticEval = TTable::noStaticEval; //only computed when needed
+
+    uint64_t positionHash = game->pos->getPositionHash();
+    TTable::Entry ttentry;
+
+    if(TTable::lookup(positionHash, ttentry)) {
+        //no cutoffs at the root, the root move has to come from this thread's own search
+        if(ttentry.depth == depth && distanceToRoot > 0) {
+            if(ttentry.entryType == 1) 
+                return ttentry.eval;
 
-    uint64_t positionHash;
+            if(ttentry.entryType == 0 && ttentry.eval >= beta) 
+                return ttentry.eval;
 
+            if(ttentry.entryType == 2 && ttentry.eval <= alpha)
+                return ttentry.eval;
 
-    int numOfSortedMoves = 0;
-    if(depth > 0) {
+        }
+
+        ttMove = Move(ttentry.move);
+
+        if(ttentry.staticEval != TTable::noStaticEval) {
+            staticEval = ttentry.staticEval;
+            count(&SearchStats::ttEvalHits);
+        }
+    }
 
-        positionHash = game.pos->getPositionHash();
-        TTable::Entry *ttentry = TTable::lookup(positionHash);
+    //null move pruning: if passing the turn still leads to a score of at least beta, a real move will most likely do so too.
+    //Not used in zugzwang prone positions in which the side to move only has pawns left
+    if(!pvNode && nullMoveAllowed && !kingInCheck && depth >= 2
+            && (game->pos->ownPieces & (game->pos->knights | game->pos->diagonals | game->pos->filesAndRanks))
+            && getStaticEval(staticEval) >= beta) {
 
-        if(ttentry != nullptr) {
-            if(ttentry->depth == depth) {
-                if(ttentry->entryType == 1) 
-                    return ttentry->eval;
+        int reduction = depth > 6 ? 3 : 2;
+        int nullMoveDepth = std::max(depth - 1 - reduction, 0);
 
-                if(ttentry->entryType == 0 && ttentry->eval >= beta) 
-                    return ttentry->eval;
+        moveStack[distanceToRoot] = Move(0, 0);
+        game->makeNullMove();
+        short nullMoveEval = -search(-beta, -(beta-1), nullMoveDepth, distanceToRoot + 1, false, moveBuffer + 343, false);
+        game->undo();
+
+        if(searchAborted) {
+            return 0;
+        }
 
-                if(ttentry->entryType == 2 && ttentry->eval <= alpha)
-                    return ttentry->eval;
+        if(nullMoveEval >= beta) {
+            //don't return unproven mate scores
+            if(isMate(nullMoveEval))
+                nullMoveEval = beta;
 
+            if(depth < nullMoveVerificationDepth) {
+                return nullMoveEval;
             }
 
-            for(int i = 0; i < numOfMoves; i++) {
-                if(moveBuffer[i] == Move(ttentry->move)) {
-                    Move tmp = moveBuffer[0];
-                    moveBuffer[0] = moveBuffer[i];
-                    moveBuffer[i] = tmp;
-                    numOfSortedMoves++;
-                    break;
-                }
+            //verification search to guard against zugzwang
+            short verificationEval = search(beta-1, beta, nullMoveDepth, distanceToRoot, false, moveBuffer + 343, false);
+
+            if(searchAborted) {
+                return 0;
             }
-        }
 
-        //if the first killer move is legal, search that move first, if the second killer move is also legal search it afterwards, if only the second move is
-        //legal search it first
-        for(int i = 0; i < 2; i++) {
-            for(int j = numOfSortedMoves; j < numOfMoves; j++) {
-                if(moveBuffer[j] == killerMoves[distanceToRoot][i]) {
-                    Move tmp = moveBuffer[numOfSortedMoves];
-                    moveBuffer[numOfSortedMoves] = killerMoves[distanceToRoot][i];
-                    moveBuffer[j] = tmp;
-                    numOfSortedMoves++;
-                    break;
-                }
+            if(verificationEval >= beta) {
+                return nullMoveEval;
             }
         }
     }
@@ -439,25 +719,39 @@ short Engine::search(short alpha, short beta, int depth, int distanceToRoot, boo
     }*/
 
     bool printCurrentMoves = false;
-    if(distanceToRoot == 0) {
+    if(distanceToRoot == 0 && threadIndex == 0) {
         //only print currently searched move if we are already searching for one second, to prevent to much traffic
         if(getExecutionTimeInms() >= 1000) {
             printCurrentMoves = true;
         }
     }
 
-    for(int i = 0; i < numOfMoves; i++) {
+    Move previousMove = distanceToRoot > 0 ? moveStack[distanceToRoot - 1] : Move(0, 0);
+    Move counterMove = ordering->counterMoves[previousMove.from][previousMove.to];
+    short (*history)[64] = ordering->history[game->pos->whitesTurn];
+
+    MovePicker movePicker(game->pos, moveBuffer, ttMove, killerMoves[distanceToRoot], counterMove, history);
 
-        if(distanceToRoot > 0 && i >= numOfSortedMoves) {
+    int numOfMoves = 0;
+    Move move;
 
-            sortCaptures(game.pos, &(moveBuffer[numOfSortedMoves]), numOfMoves-numOfSortedMoves);
+    //quiet moves that did not cause a cutoff. Their history scores are lowered if a later move does
+    Move quietsSearched[64];
+    int numOfQuietsSearched = 0;
 
-            numOfSortedMoves = numOfMoves;
+    while(movePicker.next(move)) {
+
+        //check if options.searchmoves contains moves to be searched exclusively. If not search all legal moves
+        if(distanceToRoot == 0 && options.searchMoves.size() != 0) {
+            if(std::find(options.searchMoves.begin(), options.searchMoves.end(), move) == options.searchMoves.end())
+                continue;
         }
 
+        int i = numOfMoves++;
+
         if(printCurrentMoves) {
             ioLock.lock();
-            std::cout << "info currmove " << moveBuffer[i].toString() << " currmovenumber " << i+1 << std::endl;
+            std::cout << "info currmove " << move.toString() << " currmovenumber " << i+1 << std::endl;
             ioLock.unlock();
         }
         
@@ -468,24 +762,42 @@ short Engine::search(short alpha, short beta, int depth, int distanceToRoot, boo
 
         short currentEval;
 
-        game.makeMove(moveBuffer[i]);
+        bool quietMove = !game->pos->isCapture(move) && move.flags == 0;
 
+        moveStack[distanceToRoot] = move;
+        game->makeMove(move);
+        TTable::prefetch(game->pos->getPositionHash());
 
-        if(pvNode && depth >= 1) {
-            if(i == 0) {
-                currentEval = -search(-beta, -alpha, depth - 1, distanceToRoot + 1, true, moveBuffer + numOfMoves);
-            } else {
-                currentEval = -search(-(alpha+1), -alpha, depth -1, distanceToRoot + 1, false, moveBuffer + numOfMoves);
-                if(currentEval > alpha) {
-                    //research
-                    currentEval = -search(-beta, -alpha, depth - 1, distanceToRoot+1, true, moveBuffer + numOfMoves);
+        //late move reductions: quiet moves late in the move ordering are searched with reduced depth first.
+        //If that search fails high, the move is searched again with full depth
+        bool fullDepthSearch = true;
+        if(depth >= lmrMinDepth && i >= lmrFullDepthMoves && quietMove && !kingInCheck && !game->pos->ownKingInCheck()) {
+            int reduction = reductions[std::min(depth, 63)][std::min(i, 63)] - pvNode;
+            reduction = std::min(reduction, depth - 2);
+
+            if(reduction > 0) {
+                currentEval = -search(-(alpha+1), -alpha, depth - 1 - reduction, distanceToRoot + 1, false, moveBuffer + 343, true);
+                fullDepthSearch = currentEval > alpha;
+            }
+        }
+
+        if(fullDepthSearch) {
+            if(pvNode && depth >= 1) {
+                if(i == 0) {
+                    currentEval = -search(-beta, -alpha, depth - 1, distanceToRoot + 1, true, moveBuffer + 343, true);
+                } else {
+                    currentEval = -search(-(alpha+1), -alpha, depth -1, distanceToRoot + 1, false, moveBuffer + 343, true);
+                    if(currentEval > alpha) {
+                        //research
+                        currentEval = -search(-beta, -alpha, depth - 1, distanceToRoot+1, true, moveBuffer + 343, true);
+                    }
                 }
+            } else {
+                currentEval = -search(-beta, -alpha, depth - 1, distanceToRoot + 1, false, moveBuffer + 343, true);
             }
-        } else {
-            currentEval = -search(-beta, -alpha, depth - 1, distanceToRoot + 1, false, moveBuffer + numOfMoves);
         }
 
-        game.undo();
+        game->undo();
 
         if(searchAborted) {
             return 0;
@@ -493,46 +805,75 @@ short Engine::search(short alpha, short beta, int depth, int distanceToRoot, boo
                 
         if(alpha < currentEval) {
             alpha = currentEval;
-            bestMove = moveBuffer[i];
+            bestMove = move;
+
+            if(distanceToRoot == 0) {
+                rootBestMove = bestMove;
+            }
             
             if(alpha >= beta) {
                 
                 //put the current cut-off move into the first killer move slot, if it is not already there.
-                //the move currently in the first slot is shifted to the second slot.
-                if(moveBuffer[i] != killerMoves[distanceToRoot][0]) {
+                //the move currently in the first slot is shifted to the second slot. Captures are ordered by the move picker anyways
+                if(quietMove && move != killerMoves[distanceToRoot][0]) {
                     killerMoves[distanceToRoot][1] = killerMoves[distanceToRoot][0];
-                    killerMoves[distanceToRoot][0] = moveBuffer[i];
+                    killerMoves[distanceToRoot][0] = move;
+                }
+
+                //reward the cut-off move and punish the quiet moves searched before it. Deeper searches count more
+                if(quietMove) {
+                    int bonus = std::min(depth * depth, 400);
+                    updateHistory(history[move.from][move.to], bonus);
+                    for(int j = 0; j < numOfQuietsSearched; j++) {
+                        updateHistory(history[quietsSearched[j].from][quietsSearched[j].to], -bonus);
+                    }
+
+                    if(distanceToRoot > 0) {
+                        ordering->counterMoves[previousMove.from][previousMove.to] = move;
+                    }
                 }
 
-                TTable::insert(positionHash, alpha, 0, moveBuffer[i], depth);
+                TTable::insert(positionHash, alpha, 0, move, depth, staticEval);
 
                 return alpha;
             }
         }
+
+        if(quietMove && numOfQuietsSearched < 64) {
+            quietsSearched[numOfQuietsSearched++] = move;
+        }
+    }
+
+    if(numOfMoves == 0) {
+        if(kingInCheck) {
+            return getMateEvaluation(distanceToRoot);
+        } else {
+            return 0;
+        }
     }
 
-    TTable::insert(positionHash, alpha, !(alpha > oldAlpha)+1, bestMove, depth);
+    TTable::insert(positionHash, alpha, !(alpha > oldAlpha)+1, bestMove, depth, staticEval);
 
     return alpha;
 }
 
 short Engine::qsearch(short alpha, short beta, int distanceToRoot, bool pvNode, Move *moveBuffer) {
 
-    nodesSearched ++;
+    countNode();
 
-    if(options.maxNodes && nodesSearched > options.maxNodes) { 
+    if(nodeLimitReached()) {
         searchAborted = true;
         return 0;
     }
 
-    if(Engine::stop) {
+    if(*stopSignal) {
         searchAborted = true;
         return 0;
     }
 
     int numOfMoves;
     bool kingInCheck;
-    numOfMoves = game.pos->getLegalMoves(kingInCheck, moveBuffer);
+    numOfMoves = game->pos->getLegalMoves(kingInCheck, moveBuffer);
 
 
     if(numOfMoves == 0) {
@@ -543,11 +884,11 @@ short Engine::qsearch(short alpha, short beta, int distanceToRoot, bool pvNode,
         }
     }
 
-    if(game.isPositionDraw(distanceToRoot)) {
+    if(game->isPositionDraw(distanceToRoot)) {
         return 0;
     }
 
-    short standingPat = Eval::evaluate(game.pos);
+    short standingPat = getLazyStaticEval(alpha, beta);
 
     if(standingPat >= beta)
         return standingPat;
@@ -555,21 +896,26 @@ short Engine::qsearch(short alpha, short beta, int distanceToRoot, bool pvNode,
         alpha = standingPat;
 
     
-    int numOfCaptures = sortCaptures(game.pos, moveBuffer, numOfMoves);
+    int numOfCaptures = sortCaptures(game->pos, moveBuffer, numOfMoves);
 
     for(int i = 0; i < numOfCaptures; i++) {
 
-        char victim = game.pos->getPieceOnSquare(moveBuffer[i].to);
+        char victim = game->pos->getPieceOnSquare(moveBuffer[i].to);
         int victimValue = (victim == NO_PIECE) ? Eval::params->pieceValues[PAWN] : Eval::params->pieceValues[victim]; //captures with no piece on the target square are en passant captures
         if(standingPat + victimValue + 200 <= alpha) {
             break;
         }
 
-        game.makeMove(moveBuffer[i]);
+        //captures that lose material in the exchange on the target square are not searched
+        if(game->pos->see(moveBuffer[i]) < 0) {
+            continue;
+        }
+
+        game->makeMove(moveBuffer[i]);
 
         short eval = -qsearch(-beta, -alpha, distanceToRoot+1, pvNode, moveBuffer+numOfCaptures);
 
-        game.undo();
+        game->undo();
 
         if(eval > alpha) {
             alpha = eval;
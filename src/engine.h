@@ -13,6 +13,7 @@
 #include "game.h"
 #include "ttable.h"
 #include "move.h"
+#include "pawntable.h"
 
 class Engine {
     public:
@@ -39,9 +40,45 @@ class Engine {
 
         static void setTTableSize(int sizeInMiB);
 
+        /**
+         * sets the number of threads used for the next search. The main thread reports the search results, all other threads
+         * are helpers that search the same position independently and share their results through the transposition table (lazy smp)
+         */
+        static void setNumThreads(int threads);
+
+        static const int maxThreads = 512;
+
+        /**
+         * sets the parameters of the late move reduction table. A move with the given move number, searched with the given depth
+         * is reduced by (base + log(depth) * log(move number) / divisor) plies. Both parameters are given in hundredths
+         */
+        static void setLMRParameters(int base, int divisor);
+
+        /**
+         * sets the size of the pawn table of every search thread
+         */
+        static void setPawnTableSize(int sizeInMiB);
+
+        /**
+         * selects the neural network evaluation (if a network is loaded) or the hand-crafted evaluation.
+         * Cached evaluations and the static evaluations in the transposition table of the other evaluator are discarded when switching
+         */
+        static void setUseNNUE(bool useNNUE);
+
+        /**
+         * sets the margin of the lazy evaluation in the quiescence search. The expensive evaluation terms are skipped, if the
+         * cheap ones are more than the margin (in centipawns) outside of the search window. maxLazyEvalMargin turns it off
+         */
+        static void setLazyEvalMargin(int margin);
+
+        static const int maxLazyEvalMargin = 10000;
+
     private:
         static const int maxPVLength = 10;
 
+        //quiescence search can add at most 30 plies (one per capturable piece) on top of the nominal depth
+        static const int maxSearchDepth = Game::maxSearchPly - 32;
+
         static const uint64_t connectionLagBuffer = 50;
 
         static const short maxMateDistance = 5000;
@@ -49,18 +86,69 @@ class Engine {
         static std::atomic<bool> ponder;
         static std::atomic<bool> stop;
 
-        static bool searchAborted;
+        static std::atomic<bool> helpersStop;
+
+        static int numThreads;
 
-        static uint64_t nodesSearched;
+        //search statistics of all threads, each on its own cache line
+        struct alignas(64) SearchStats {
+            std::atomic<uint64_t> nodes;
+            std::atomic<uint64_t> evaluations; //static evaluations computed by Eval::evaluate() or NNUE::evaluate()
+            std::atomic<uint64_t> evalCacheHits;
+            std::atomic<uint64_t> ttEvalHits; //static evaluations taken from the transposition table
+            std::atomic<uint64_t> lazyEvals; //evaluations in the quiescence search that were cut short after the cheap terms
+        };
+
+        static SearchStats searchStats[maxThreads];
 
         static Engine::Options options;
 
-        static Game game;
+        //the position to analyze. Every search thread works on its own copy
+        static Game rootGame;
+
+        //search state of the individual threads
+        static thread_local int threadIndex; //0 for the main thread
+        static thread_local std::atomic<bool> *stopSignal; //stop for the main thread, helpersStop for helper threads
+        static thread_local bool searchAborted;
+        static thread_local Game *game;
+        static thread_local Move rootBestMove;
+        static thread_local Move (*killerMoves)[2];
+        static thread_local Move *moveStack; //moves leading from the root to the current node, indexed by distance to root. Move(0, 0) for null moves
+
+        //quiet move ordering statistics of a search thread. They are not cleared between searches, but aged
+        struct OrderingTables {
+            short history[2][64][64]; //indexed by side to move (1 for white), from and to square
+            Move counterMoves[64][64]; //the quiet move that last refuted a move, indexed by the from and to square of the refuted move
+        };
+
+        static const int maxHistory = 16384;
+
+        static OrderingTables *orderingTables[maxThreads];
+        static thread_local OrderingTables *ordering;
+
+        //allocates the ordering tables of the current thread on its first search and ages them on every later one
+        static void prepareOrderingTables();
+
+        //pawn tables of the search threads. They are kept between searches, as pawn structures repeat across moves
+        static PawnTable *pawnTables[maxThreads];
+        static int pawnTableSize; //in MiB
+
+        static bool useNNUE;
+
+        static int lazyEvalMargin;
+
+        //allocates the pawn table of the current thread if it doesn't exist yet or has the wrong size
+        static void preparePawnTable();
+
+        //moves a history entry towards +-maxHistory by the given bonus, the closer it already is the smaller the step
+        static void updateHistory(short& entry, int bonus);
 
         static std::chrono::time_point<std::chrono::steady_clock> executionStartTime;
 
         static std::thread workerThread;
 
+        static std::vector<std::thread> helperThreads;
+
         static std::thread timeController;
         static std::mutex timeThreadMutex;
         static std::condition_variable timingAbortCondition;
@@ -72,17 +160,67 @@ class Engine {
 
         static void analyze();
 
+        static void helperSearch(int index);
+
+        static void startHelpers();
+
+        static void stopHelpers();
+
+        //increments a counter of the search statistics of the current thread
+        static void count(std::atomic<uint64_t> SearchStats::*counter);
+
+        static void countNode();
+
+        //returns the number of nodes searched by all threads since the start of the search
+        static uint64_t getNodeCount();
+
+        //with more than one thread, the node limit is only compared with the total node count every nodeLimitCheckInterval nodes of a thread
+        static const uint64_t nodeLimitCheckInterval = 1024;
+
+        //returns true if the search exceeded the node limit of the go command
+        static bool nodeLimitReached();
+
+        //returns the sum of the given counter over all threads
+        static uint64_t getStatsSum(std::atomic<uint64_t> SearchStats::*counter);
+
+        /**
+         * returns the static evaluation of the current position, from the evaluation cache if possible.
+         * @param staticEval the static evaluation of the node if already known (for example from the transposition table),
+         * otherwise TTable::noStaticEval. Is set to the returned evaluation
+         */
+        static short getStaticEval(short& staticEval);
+
+        /**
+         * returns the static evaluation of the current position, or only a bound if that is already far outside of [alpha, beta].
+         * Bounds are not cached
+         */
+        static short getLazyStaticEval(short alpha, short beta);
+
         static int64_t getExecutionTimeInms();
 
         static void setTimer();
 
         static void clearTimer();
 
-        static short searchWrapper(int depth);
+        static short searchWrapper(int depth, short alpha = -32767, short beta = 32767);
+
+        //aspiration windows: from this depth on, the root is searched with a window around the score of the previous iteration.
+        //The window is widened in the failing direction until the score lies inside
+        static const int aspirationMinDepth = 4;
+        static const int aspirationWindow = 25;
+        static const int aspirationMaxWindow = 1000; //if the window would get wider, the full window is used
 
-        static Move (*killerMoves)[2];
+        //null move pruning
+        static const int nullMoveVerificationDepth = 8; //null move cutoffs at this depth or higher are verified by a reduced search without null moves
 
-        static short search(short alpha, short beta, int depth, int distanceToRoot, bool pvNode, Move *moveBuffer);
+        //late move reductions
+        static const int lmrMinDepth = 3;
+        static const int lmrFullDepthMoves = 3; //the first moves are never reduced
+        static int lmrBase;
+        static int lmrDivisor;
+        static int reductions[64][64]; //indexed by depth and move number
+
+        static short search(short alpha, short beta, int depth, int distanceToRoot, bool pvNode, Move *moveBuffer, bool nullMoveAllowed);
 
         static short qsearch(short alpha, short beta, int distanceToRoot, bool pvNode, Move *moveBuffer);
         
@@ -92,8 +230,6 @@ class Engine {
 
         static bool isMate(short evaluation);
 
-        static int getMVV_LVA_eval(Game::Position* pos, Move move);
-
         static int sortCaptures(Game::Position* pos, Move *moveBuffer, int numOfMoves);
 };
 
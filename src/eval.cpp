@@ -1,15 +1,9 @@
 #include "game.h"
 #include "eval.h"
 #include "bitboard.h"
+#include "pawntable.h"
 
 
-uint64_t Eval::occupiedSquares;
-uint64_t Eval::piecesByColor[2];
-uint64_t Eval::kingRing[2];
-short Eval::kingDanger[2];
-uint64_t Eval::attackedByPawn[2];
-uint64_t Eval::potentialOutpostSquares[2];
-
 using namespace Bitboard;
 
 
@@ -165,31 +159,28 @@ Eval::Params defaultParameters = {
 Eval::Params *Eval::params = &defaultParameters;
 
 
+//the material itself is part of the incrementally updated piece-square score of the position
 template<char color>
-ScorePair Eval::evaluateMaterial(Game::Position*pos) {
-    ScorePair score = __builtin_popcountll(pos->pawns & piecesByColor[color]) * params->pieceValues[PAWN]
-                    + __builtin_popcountll(pos->knights & piecesByColor[color]) * params->pieceValues[KNIGHT]
-                    + __builtin_popcountll(~pos->filesAndRanks & pos->diagonals & piecesByColor[color]) * params->pieceValues[BISHOP]
-                    + __builtin_popcountll(pos->filesAndRanks & ~pos->diagonals & piecesByColor[color]) * params->pieceValues[ROOK]
-                    + __builtin_popcountll(pos->filesAndRanks & pos->diagonals & piecesByColor[color]) * params->pieceValues[QUEEN];
-
-    if (__builtin_popcountll(~pos->filesAndRanks & pos->diagonals & piecesByColor[color]) >= 2) {
+ScorePair Eval::evaluateMaterial(EvalContext& context, Game::Position* pos) {
+    ScorePair score;
+
+    if (__builtin_popcountll(~pos->filesAndRanks & pos->diagonals & context.piecesByColor[color]) >= 2) {
         score += params->bishopPair;
     }
     return score;
 }
 
 template<char color>
-ScorePair Eval::evaluatePawns(Game::Position* pos) {
+ScorePair Eval::evaluatePawnStructure(PawnStructure& pawns, EvalContext& context, Game::Position* pos) {
 
     ScorePair score;
 
-    uint64_t ourPawns = piecesByColor[color] & pos->pawns;
+    uint64_t ourPawns = context.piecesByColor[color] & pos->pawns;
 
     if(color == WHITE) {
-        attackedByPawn[WHITE] = shift<NORTH_EAST>(ourPawns) | shift<NORTH_WEST>(ourPawns);
+        pawns.attackedByPawn[WHITE] = shift<NORTH_EAST>(ourPawns) | shift<NORTH_WEST>(ourPawns);
     } else {
-        attackedByPawn[BLACK] = shift<SOUTH_EAST>(ourPawns) | shift<SOUTH_WEST>(ourPawns);
+        pawns.attackedByPawn[BLACK] = shift<SOUTH_EAST>(ourPawns) | shift<SOUTH_WEST>(ourPawns);
     }
 
     uint64_t squaresInFrontOfPawns;
@@ -205,11 +196,11 @@ ScorePair Eval::evaluatePawns(Game::Position* pos) {
         squaresInFrontOfPawns |= squaresInFrontOfPawns << 32;
     }
 
-    potentialOutpostSquares[!color] = ~(shift<WEST>(squaresInFrontOfPawns) | shift<EAST>(squaresInFrontOfPawns));
+    pawns.potentialOutpostSquares[!color] = ~(shift<WEST>(squaresInFrontOfPawns) | shift<EAST>(squaresInFrontOfPawns));
 
     //stacked pawns
     uint64_t stackedPawns = squaresInFrontOfPawns & ourPawns;
-    score += params->stackedPawns * P(__builtin_popcountll(stackedPawns));
+    score += params->stackedPawns * __builtin_popcountll(stackedPawns);
 
     //isolated pawns
     uint64_t pawnFiles;
@@ -228,14 +219,14 @@ ScorePair Eval::evaluatePawns(Game::Position* pos) {
 
     isolatedPawnFiles &= ~stackedPawnFiles;
 
-    score += params->isolatedPawns * P(__builtin_popcountll(isolatedPawnFiles));
+    score += params->isolatedPawns * __builtin_popcountll(isolatedPawnFiles);
 
     //enemy passed pawns
     //to calculate our passed pawns, we need to know the squares in front of enemy pawns. Since we already calculated the
     //squares in front of our pawns, we just calculate enemy passed pawns and substract their evaluation from the score.
 
     uint64_t stoppable = squaresInFrontOfPawns | shift<WEST>(squaresInFrontOfPawns) | shift<EAST>(squaresInFrontOfPawns);
-    uint64_t enemyPassedPawns = piecesByColor[!color] & pos->pawns & ~stoppable;
+    uint64_t enemyPassedPawns = context.piecesByColor[!color] & pos->pawns & ~stoppable;
 
     foreach(enemyPassedPawns, [&](char square) {
         char rank = square / 8;
@@ -245,9 +236,26 @@ ScorePair Eval::evaluatePawns(Game::Position* pos) {
         score -= params->passedPawns[rank-1];
     });
 
+    //pawns blocked by an enemy pawn
+    if(color == WHITE) {
+        pawns.blockedPawns[color] = shift<SOUTH>(context.piecesByColor[!color] & pos->pawns) & ourPawns;
+    } else {
+        pawns.blockedPawns[color] = shift<NORTH>(context.piecesByColor[!color] & pos->pawns) & ourPawns;
+    }
+
+    return score;
+}
+
+template<char color>
+ScorePair Eval::evaluatePawnInteractions(EvalContext& context, Game::Position* pos) {
+
+    ScorePair score;
+
+    uint64_t ourPawns = context.piecesByColor[color] & pos->pawns;
+
     //pawns on square with same color as bishop
 
-    uint64_t bishops = piecesByColor[color] & pos->diagonals & ~pos->filesAndRanks;
+    uint64_t bishops = context.piecesByColor[color] & pos->diagonals & ~pos->filesAndRanks;
     
     uint64_t bishopColorSquares = 0;
     if(bishops & lightSquares)
@@ -255,56 +263,45 @@ ScorePair Eval::evaluatePawns(Game::Position* pos) {
     if(bishops & darkSquares)
         bishopColorSquares |= darkSquares;
 
-    uint64_t blockedPawns;
-    if(color == WHITE) {
-        blockedPawns = shift<SOUTH>(piecesByColor[!color] & pos->pawns) & ourPawns;
-    } else {
-        blockedPawns = shift<NORTH>(piecesByColor[!color] & pos->pawns) & ourPawns;
-    }
-
-    score += params->blockedPawnOnBishopColor * P(__builtin_popcountll(blockedPawns & bishopColorSquares));
-    score += params->unblockedPawnOnBishopColor * P(__builtin_popcountll(ourPawns & ~blockedPawns & bishopColorSquares));
+    score += params->blockedPawnOnBishopColor * __builtin_popcountll(context.pawns->blockedPawns[color] & bishopColorSquares);
+    score += params->unblockedPawnOnBishopColor * __builtin_popcountll(ourPawns & ~context.pawns->blockedPawns[color] & bishopColorSquares);
 
     //king ring attack and defense
     uint64_t kingRingAttackSquares[2];
     for(int i = WHITE; i <= BLACK; i++) {
         if(color == WHITE) {
-            kingRingAttackSquares[i] = shift<SOUTH_WEST>(kingRing[i]) | shift<SOUTH_EAST>(kingRing[i]);
+            kingRingAttackSquares[i] = shift<SOUTH_WEST>(context.kingRing[i]) | shift<SOUTH_EAST>(context.kingRing[i]);
         } else {
-            kingRingAttackSquares[i] = shift<NORTH_WEST>(kingRing[i]) | shift<NORTH_EAST>(kingRing[i]);
+            kingRingAttackSquares[i] = shift<NORTH_WEST>(context.kingRing[i]) | shift<NORTH_EAST>(context.kingRing[i]);
         }
     }
 
-    kingDanger[color] -= params->kingRingDefender[PAWN] * __builtin_popcountll(ourPawns & kingRingAttackSquares[color]);
-    kingDanger[!color] += params->kingRingAttacker[PAWN] * __builtin_popcountll(ourPawns & kingRingAttackSquares[!color]);
+    context.kingDanger[color] -= params->kingRingDefender[PAWN] * __builtin_popcountll(ourPawns & kingRingAttackSquares[color]);
+    context.kingDanger[!color] += params->kingRingAttacker[PAWN] * __builtin_popcountll(ourPawns & kingRingAttackSquares[!color]);
 
     return score;
 }
 
 
 template<char pieceType, char color>
-ScorePair Eval::evaluatePiece(Game::Position* pos, char square) {
-
-    char flippedSquare = square;
-    if(color == BLACK) {
-        flippedSquare ^= 56;
-    }
+ScorePair Eval::evaluatePiece(EvalContext& context, Game::Position* pos, char square) {
 
-    ScorePair score = params->pieceSquare[pieceType - 1][flippedSquare];
+    //piece-square values are part of the incrementally updated score of the position
+    ScorePair score;
 
     if(pieceType == KING) {
         //initialize fields for king danger calculations
-        kingRing[color] = getKingMoveSquares(__builtin_ctzll(piecesByColor[color] & pos->kings)) | getBitboard(square);
-        kingDanger[color] = 0;
-
-        kingDanger[color] += params->kingAttackRays[0][__builtin_popcountll(getBlockedRay<WEST, false>(square, piecesByColor[!color]))];
-        kingDanger[color] += params->kingAttackRays[0][__builtin_popcountll(getBlockedRay<EAST, false>(square, piecesByColor[!color]))];
-        kingDanger[color] += params->kingAttackRays[1][__builtin_popcountll(getBlockedRay<NORTH, false>(square, piecesByColor[!color]))];
-        kingDanger[color] += params->kingAttackRays[1][__builtin_popcountll(getBlockedRay<SOUTH, false>(square, piecesByColor[!color]))];
-        kingDanger[color] += params->kingAttackRays[2][__builtin_popcountll(getBlockedRay<NORTH_WEST, false>(square, piecesByColor[!color]))];
-        kingDanger[color] += params->kingAttackRays[2][__builtin_popcountll(getBlockedRay<NORTH_EAST, false>(square, piecesByColor[!color]))];
-        kingDanger[color] += params->kingAttackRays[2][__builtin_popcountll(getBlockedRay<SOUTH_WEST, false>(square, piecesByColor[!color]))];
-        kingDanger[color] += params->kingAttackRays[2][__builtin_popcountll(getBlockedRay<SOUTH_EAST, false>(square, piecesByColor[!color]))];
+        context.kingRing[color] = getKingMoveSquares(__builtin_ctzll(context.piecesByColor[color] & pos->kings)) | getBitboard(square);
+        context.kingDanger[color] = 0;
+
+        context.kingDanger[color] += params->kingAttackRays[0][__builtin_popcountll(getBlockedRay<WEST, false>(square, context.piecesByColor[!color]))];
+        context.kingDanger[color] += params->kingAttackRays[0][__builtin_popcountll(getBlockedRay<EAST, false>(square, context.piecesByColor[!color]))];
+        context.kingDanger[color] += params->kingAttackRays[1][__builtin_popcountll(getBlockedRay<NORTH, false>(square, context.piecesByColor[!color]))];
+        context.kingDanger[color] += params->kingAttackRays[1][__builtin_popcountll(getBlockedRay<SOUTH, false>(square, context.piecesByColor[!color]))];
+        context.kingDanger[color] += params->kingAttackRays[2][__builtin_popcountll(getBlockedRay<NORTH_WEST, false>(square, context.piecesByColor[!color]))];
+        context.kingDanger[color] += params->kingAttackRays[2][__builtin_popcountll(getBlockedRay<NORTH_EAST, false>(square, context.piecesByColor[!color]))];
+        context.kingDanger[color] += params->kingAttackRays[2][__builtin_popcountll(getBlockedRay<SOUTH_WEST, false>(square, context.piecesByColor[!color]))];
+        context.kingDanger[color] += params->kingAttackRays[2][__builtin_popcountll(getBlockedRay<SOUTH_EAST, false>(square, context.piecesByColor[!color]))];
 
     } else {
 
@@ -314,34 +311,34 @@ ScorePair Eval::evaluatePiece(Game::Position* pos, char square) {
             if(pieceType == KNIGHT) {
                 attacks = getKnightMoveSquares(square);
             } else if(pieceType == BISHOP) {
-                attacks = pos->getBishopAttacks(square, occupiedSquares);
+                attacks = pos->getBishopAttacks(square, context.occupiedSquares);
             } else if(pieceType == ROOK) {
-                attacks = pos->getRookAttacks(square, occupiedSquares);
+                attacks = pos->getRookAttacks(square, context.occupiedSquares);
             } else if(pieceType == QUEEN) {
-                attacks = pos->getRookAttacks(square, occupiedSquares) | pos->getBishopAttacks(square, occupiedSquares);
+                attacks = pos->getRookAttacks(square, context.occupiedSquares) | pos->getBishopAttacks(square, context.occupiedSquares);
             }
 
             //is the piece defending our king?
-            if(attacks & kingRing[color]) {
-                kingDanger[color] -= params->kingRingDefender[pieceType-1];
+            if(attacks & context.kingRing[color]) {
+                context.kingDanger[color] -= params->kingRingDefender[pieceType-1];
             }
 
             //is the piece attacking the enemy king?
-            if(attacks & kingRing[!color]) {
-                kingDanger[!color] += params->kingRingAttacker[pieceType-1];
+            if(attacks & context.kingRing[!color]) {
+                context.kingDanger[!color] += params->kingRingAttacker[pieceType-1];
             }
 
             //mobility
-            uint64_t moves = attacks & ~piecesByColor[color]; //pseudo legal moves
+            uint64_t moves = attacks & ~context.piecesByColor[color]; //pseudo legal moves
 
             //remove squares controlled by enemy pawns
-            moves &= ~attackedByPawn[!color];
+            moves &= ~context.pawns->attackedByPawn[!color];
 
             score += params->mobility[pieceType-2][__builtin_popcountll(moves)];
 
             //outposts
             if(pieceType == BISHOP || pieceType == KNIGHT) {
-                if(getBitboard(square) & attackedByPawn[color] & potentialOutpostSquares[color]) {
+                if(getBitboard(square) & context.pawns->attackedByPawn[color] & context.pawns->potentialOutpostSquares[color]) {
                     score += (pieceType == KNIGHT) ? params->knightOutpost : params->bishopOutpost;
                 }
             }
@@ -351,7 +348,7 @@ ScorePair Eval::evaluatePiece(Game::Position* pos, char square) {
                 uint64_t file = ((uint64_t) 0x0101010101010101) << (square % 8);
                 if((pos->pawns & file) == 0) {
                     score += params->rookOnOpenFile;
-                } else if((pos->pawns & piecesByColor[color] & file) == 0) {
+                } else if((pos->pawns & context.piecesByColor[color] & file) == 0) {
                     score += params->rookOnHalfOpenFile;
                 }
             }
@@ -363,92 +360,133 @@ ScorePair Eval::evaluatePiece(Game::Position* pos, char square) {
 
 
 
-short Eval::evaluate(Game::Position* pos) {
+short Eval::evaluate(Game::Position* pos, PawnTable *pawnTable) {
+    bool complete;
+    return evaluate<false>(pos, pawnTable, nullptr, 0, 0, complete);
+}
+
+short Eval::evaluate(Game::Position* pos, PawnTable *pawnTable, int lowerLimit, int upperLimit, bool& complete) {
+    return evaluate<true>(pos, pawnTable, nullptr, lowerLimit, upperLimit, complete);
+}
+
+short Eval::evaluate(Game::Position* pos, const PawnStructure& pawnStructure) {
+    bool complete;
+    return evaluate<false>(pos, nullptr, &pawnStructure, 0, 0, complete);
+}
 
-    int gamePhase = 1 * __builtin_popcountll(pos->knights | (pos->diagonals & ~pos->filesAndRanks))
-                  + 2 * __builtin_popcountll(pos->filesAndRanks & ~pos->diagonals)
-                  + 4 * __builtin_popcountll(pos->filesAndRanks & pos->diagonals);
+short Eval::taper(ScorePair score, int gamePhase, bool whitesTurn) {
+    short finalScore = ((gamePhase * score.mg()) + ((24 - gamePhase) * score.eg())) / 24;
+
+    if(!whitesTurn) {
+        finalScore = -finalScore;
+    }
+
+    return finalScore;
+}
+
+template<bool lazy>
+short Eval::evaluate(Game::Position* pos, PawnTable *pawnTable, const PawnStructure *pawnStructure, int lowerLimit, int upperLimit, bool& complete) {
+
+    //scratch space of this evaluation. Nothing on the evaluation path is global, so evaluations can run concurrently
+    EvalContext context;
+
+    int gamePhase = pos->gamePhase;
     
-    occupiedSquares = pos->pawns | pos->knights | pos->diagonals | pos->filesAndRanks | pos->kings;
+    context.occupiedSquares = pos->pawns | pos->knights | pos->diagonals | pos->filesAndRanks | pos->kings;
 
-    piecesByColor[!(pos->whitesTurn)] = pos->ownPieces;
-    piecesByColor[pos->whitesTurn] = occupiedSquares & ~pos->ownPieces;
+    context.piecesByColor[!(pos->whitesTurn)] = pos->ownPieces;
+    context.piecesByColor[pos->whitesTurn] = context.occupiedSquares & ~pos->ownPieces;
 
-    ScorePair score;
+    //material and piece-square values, updated incrementally when making moves
+    ScorePair score = pos->psqtScore;
 
-    //material
-    score += evaluateMaterial<WHITE>(pos);
-    score -= evaluateMaterial<BLACK>(pos);
+    //bishop pair
+    score += evaluateMaterial<WHITE>(context, pos);
+    score -= evaluateMaterial<BLACK>(context, pos);
 
-    //kings
-    score += evaluatePiece<KING, WHITE>(pos, __builtin_ctzll(piecesByColor[WHITE] & pos->kings));
-    score -= evaluatePiece<KING, BLACK>(pos, __builtin_ctzll(piecesByColor[BLACK] & pos->kings));
+    //pawn structure. It only depends on the pawns and is cached in the pawn table of the thread
+    PawnStructure computedPawnStructure;
+    if(pawnStructure == nullptr) {
+        PawnTable::Entry *pawnEntry = pawnTable != nullptr ? pawnTable->getEntry(pos->pawnHash) : nullptr;
 
+        if(pawnEntry != nullptr && pawnEntry->key == pos->pawnHash) {
+            pawnStructure = &pawnEntry->pawns;
+        } else {
+            computedPawnStructure.score = evaluatePawnStructure<WHITE>(computedPawnStructure, context, pos)
+                                        - evaluatePawnStructure<BLACK>(computedPawnStructure, context, pos);
 
-    //pawn structure
-    score += evaluatePawns<WHITE>(pos);
-    score -= evaluatePawns<BLACK>(pos);
+            if(pawnEntry != nullptr) {
+                pawnEntry->key = pos->pawnHash;
+                pawnEntry->pawns = computedPawnStructure;
+            }
+            pawnStructure = &computedPawnStructure;
+        }
+    }
+    context.pawns = pawnStructure;
+    score += pawnStructure->score;
+
+    //the remaining terms are expensive. If the cheap ones are already far outside the window, they are returned as a bound
+    if(lazy) {
+        short lazyScore = taper(score, gamePhase, pos->whitesTurn);
+        if(lazyScore <= lowerLimit || lazyScore >= upperLimit) {
+            complete = false;
+            return lazyScore;
+        }
+    }
+    complete = true;
 
+    //kings
+    score += evaluatePiece<KING, WHITE>(context, pos, __builtin_ctzll(context.piecesByColor[WHITE] & pos->kings));
+    score -= evaluatePiece<KING, BLACK>(context, pos, __builtin_ctzll(context.piecesByColor[BLACK] & pos->kings));
 
-    //pawns (only for piece-square values)
-    foreach(pos->pawns & piecesByColor[WHITE], [&](char square) {
-        score += evaluatePiece<PAWN, WHITE>(pos, square);
-    });
+    //pawns in relation to bishops and kings
+    score += evaluatePawnInteractions<WHITE>(context, pos);
+    score -= evaluatePawnInteractions<BLACK>(context, pos);
 
-    foreach(pos->pawns & piecesByColor[BLACK], [&](char square) {
-        score -= evaluatePiece<PAWN, BLACK>(pos, square);
-    });
 
     //knights
-    foreach(pos->knights & piecesByColor[WHITE], [&](char square) {
-        score += evaluatePiece<KNIGHT, WHITE>(pos, square);
+    foreach(pos->knights & context.piecesByColor[WHITE], [&](char square) {
+        score += evaluatePiece<KNIGHT, WHITE>(context, pos, square);
     });
 
-    foreach(pos->knights & piecesByColor[BLACK], [&](char square) {
-        score -= evaluatePiece<KNIGHT, BLACK>(pos, square);
+    foreach(pos->knights & context.piecesByColor[BLACK], [&](char square) {
+        score -= evaluatePiece<KNIGHT, BLACK>(context, pos, square);
     });
 
     //bishops
-    foreach(pos->diagonals & ~pos->filesAndRanks & piecesByColor[WHITE], [&](char square) {
-        score += evaluatePiece<BISHOP, WHITE>(pos, square);
+    foreach(pos->diagonals & ~pos->filesAndRanks & context.piecesByColor[WHITE], [&](char square) {
+        score += evaluatePiece<BISHOP, WHITE>(context, pos, square);
     });
 
-    foreach(pos->diagonals & ~pos->filesAndRanks & piecesByColor[BLACK], [&](char square) {
-        score -= evaluatePiece<BISHOP, BLACK>(pos, square);
+    foreach(pos->diagonals & ~pos->filesAndRanks & context.piecesByColor[BLACK], [&](char square) {
+        score -= evaluatePiece<BISHOP, BLACK>(context, pos, square);
     });
 
     //rooks
-    foreach(~pos->diagonals & pos->filesAndRanks & piecesByColor[WHITE], [&](char square) {
-        score += evaluatePiece<ROOK, WHITE>(pos, square);
+    foreach(~pos->diagonals & pos->filesAndRanks & context.piecesByColor[WHITE], [&](char square) {
+        score += evaluatePiece<ROOK, WHITE>(context, pos, square);
     });
 
-    foreach(~pos->diagonals & pos->filesAndRanks & piecesByColor[BLACK], [&](char square) {
-        score -= evaluatePiece<ROOK, BLACK>(pos, square);
+    foreach(~pos->diagonals & pos->filesAndRanks & context.piecesByColor[BLACK], [&](char square) {
+        score -= evaluatePiece<ROOK, BLACK>(context, pos, square);
     });
 
     //queens
-    foreach(pos->diagonals & pos->filesAndRanks & piecesByColor[WHITE], [&](char square) {
-        score += evaluatePiece<QUEEN, WHITE>(pos, square);
+    foreach(pos->diagonals & pos->filesAndRanks & context.piecesByColor[WHITE], [&](char square) {
+        score += evaluatePiece<QUEEN, WHITE>(context, pos, square);
     });
 
-    foreach(pos->diagonals & pos->filesAndRanks & piecesByColor[BLACK], [&](char square) {
-        score -= evaluatePiece<QUEEN, BLACK>(pos, square);
+    foreach(pos->diagonals & pos->filesAndRanks & context.piecesByColor[BLACK], [&](char square) {
+        score -= evaluatePiece<QUEEN, BLACK>(context, pos, square);
     });
     
     //king danger
     ScorePair kingDangerScore[2];
     for(int i = 0; i < 2 ; i++) {
-        kingDangerScore[i].mg = kingDanger[i];
-        kingDangerScore[i].eg = (kingDanger[i] * params->endGameScaleDown) / 1024;
+        kingDangerScore[i] = ScorePair(context.kingDanger[i], (context.kingDanger[i] * params->endGameScaleDown) / 1024);
     }
 
     score += kingDangerScore[BLACK] - kingDangerScore[WHITE];
 
-    short finalScore = ((gamePhase * score.mg) + ((24 - gamePhase) * score.eg)) / 24;
-
-    if(!pos->whitesTurn) {
-        finalScore = -finalScore;
-    }
-
-    return finalScore;
+    return taper(score, gamePhase, pos->whitesTurn);
 }
\ No newline at end of file
@@ -2,66 +2,31 @@
 #define EVAL_H
 
 #include "game.h"
+#include "scorepair.h"
 #include "iostream"
 
-//evaluation
-class ScorePair {
-    public:
-        short mg;
-        short eg;
-
-        ScorePair() {
-            this->mg = 0;
-            this->eg = 0;
-        }
-
-        ScorePair(int score) {
-            this->mg = score;
-            this->eg = score;
-        }
-
-        ScorePair(int mg, int eg) {
-            this->mg = mg;
-            this->eg = eg;
-        }
-
-        ScorePair operator+ (ScorePair obj) {
-            return ScorePair(this->mg + obj.mg, this->eg + obj.eg);
-        }
-        ScorePair operator- (ScorePair obj) {
-            return ScorePair(this->mg - obj.mg, this->eg - obj.eg);
-        }
-        ScorePair operator* (ScorePair obj) {
-            return ScorePair(this->mg * obj.mg, this->eg * obj.eg);
-        }
-        ScorePair operator/ (ScorePair obj) {
-            return ScorePair(this->mg / obj.mg, this->eg / obj.eg);
-        }
-        
-        ScorePair& operator+= (ScorePair obj) {
-            this->mg += obj.mg;
-            this->eg += obj.eg;
-            return *this;
-        }
-        ScorePair& operator-= (ScorePair obj) {
-            this->mg -= obj.mg;
-            this->eg -= obj.eg;
-            return *this;
-        }
-        ScorePair& operator*= (ScorePair obj) {
-            this->mg *= obj.mg;
-            this->eg *= obj.eg;
-            return *this;
-        }
-        ScorePair& operator/= (ScorePair obj) {
-            this->mg /= obj.mg;
-            this->eg /= obj.eg;
-            return *this;
-        }
+class PawnTable;
+
+/**
+ * results of the pawn structure evaluation. They only depend on the pawns, so they are cached in the pawn table
+ * or computed for many positions at once by BatchEval
+ */
+struct PawnStructure {
+    uint64_t attackedByPawn[2];
+    uint64_t potentialOutpostSquares[2];
+    uint64_t blockedPawns[2];
+    ScorePair score; //from whites perspective
+};
 
-        void print() {
-            std::cout << this->mg << ", " << this->eg << std::endl;
-        }
+/**
+ * intermediate results of one evaluation, shared by the evaluation terms. It lives on the stack of the evaluating thread
+ */
+struct EvalContext {
+    uint64_t occupiedSquares;
+    uint64_t piecesByColor[2];
+    uint64_t kingRing[2];
+    short kingDanger[2];
+    const PawnStructure *pawns;
 };
 
 class Eval {
@@ -102,25 +67,73 @@ class Eval {
 
         static Params *params;
 
-        static short evaluate(Game::Position* pos);
+        /**
+         * evaluates the position from the view of the side to move. Can be called from several threads at once
+         * @param pawnTable caches the pawn structure evaluation. Must not be shared between threads. Without a pawn table the pawn structure is evaluated every time
+         */
+        static short evaluate(Game::Position* pos, PawnTable *pawnTable = nullptr);
+
+        /**
+         * lazy evaluation: the cheap evaluation terms (material, piece-square values and pawn structure) are computed first.
+         * If their sum is already outside of (lowerLimit, upperLimit), it is returned without computing the expensive ones
+         * @param complete is set to false, if the evaluation was cut short. The result must not be cached in that case
+         */
+        static short evaluate(Game::Position* pos, PawnTable *pawnTable, int lowerLimit, int upperLimit, bool& complete);
+
+        /**
+         * evaluates the position with a pawn structure that was already computed by the caller
+         */
+        static short evaluate(Game::Position* pos, const PawnStructure& pawnStructure);
+
+        /**
+         * @returns the material and piece-square value of a piece on the given square, from whites perspective.
+         * The sum over all pieces is kept up to date incrementally in Game::Position::psqtScore
+         */
+        static ScorePair getPieceScore(char pieceType, char square, bool black) {
+            ScorePair score = params->pieceSquare[pieceType - 1][black ? square ^ 56 : square];
+            if(pieceType != KING)
+                score += ScorePair(params->pieceValues[pieceType]);
+            return black ? -score : score;
+        }
+
+        /**
+         * @returns the piece-square value (without the material) of a piece on the given square, from whites perspective
+         */
+        static ScorePair getPieceSquareScore(char pieceType, char square, bool black) {
+            ScorePair score = params->pieceSquare[pieceType - 1][black ? square ^ 56 : square];
+            return black ? -score : score;
+        }
+
+        /**
+         * @returns the contribution of a piece to the game phase (24 with all pieces on the board, 0 with only kings and pawns)
+         */
+        static int getPhaseWeight(char pieceType) {
+            static const int phaseWeights[7] = {0, 0, 1, 1, 2, 4, 0};
+            return phaseWeights[(int) pieceType];
+        }
 
     private:
 
-        static uint64_t occupiedSquares;
-        static uint64_t piecesByColor[2];
-        static uint64_t kingRing[2];
-        static short kingDanger[2];
-        static uint64_t attackedByPawn[2];
-        static uint64_t potentialOutpostSquares[2];
+        //the pawn structure is taken from the pawnStructure argument, the pawn table or computed, in this order
+        template<bool lazy>
+        static short evaluate(Game::Position* pos, PawnTable *pawnTable, const PawnStructure *pawnStructure, int lowerLimit, int upperLimit, bool& complete);
+
+        //interpolates between the middle game and end game score and returns the result from the view of the side to move
+        static short taper(ScorePair score, int gamePhase, bool whitesTurn);
 
         template<char color>
-        static ScorePair evaluateMaterial(Game::Position*pos);
+        static ScorePair evaluateMaterial(EvalContext& context, Game::Position* pos);
 
         template<char pieceType, char color>
-        static ScorePair evaluatePiece(Game::Position* pos, char square);
+        static ScorePair evaluatePiece(EvalContext& context, Game::Position* pos, char square);
+
+        //evaluation terms that only depend on the pawns, which can be cached in the pawn table
+        template<char color>
+        static ScorePair evaluatePawnStructure(PawnStructure& pawns, EvalContext& context, Game::Position* pos);
 
+        //evaluation terms of the pawns in relation to other pieces
         template<char color>
-        static ScorePair evaluatePawns(Game::Position* pos);
+        static ScorePair evaluatePawnInteractions(EvalContext& context, Game::Position* pos);
 
 };
 
@@ -0,0 +1,10 @@
+#include <cstdint>
+#include <cstring>
+
+#include "evalcache.h"
+
+uint64_t EvalCache::table[EvalCache::numOfEntries];
+
+void EvalCache::clear() {
+    memset(table, 0, sizeof(table));
+}
@@ -0,0 +1,40 @@
+#ifndef EVALCACHE_H
+#define EVALCACHE_H
+
+#include <cstdint>
+
+/**
+ * small cache of static evaluations, shared by all search threads.
+ * Every entry is a single 64 bit word: the upper 48 bits of the position hash and the 16 bit evaluation.
+ * As the word is written and read at once, concurrent accesses can't mix the key of one position with the evaluation of another
+ */
+class EvalCache {
+    public:
+        /**
+         * @param eval is set to the cached evaluation (from the view of the side to move), if the position was found
+         * @returns true if the position was found
+         */
+        static inline bool lookup(uint64_t hash, short& eval) {
+            uint64_t entry = __atomic_load_n(&table[hash & indexMask], __ATOMIC_RELAXED);
+            if(((entry ^ hash) & keyMask) == 0) {
+                eval = (short) (entry & 0xffff);
+                return true;
+            }
+            return false;
+        }
+
+        static inline void insert(uint64_t hash, short eval) {
+            __atomic_store_n(&table[hash & indexMask], (hash & keyMask) | (uint16_t) eval, __ATOMIC_RELAXED);
+        }
+
+        static void clear();
+
+    private:
+        static const int numOfEntries = 1 << 16;
+        static const uint64_t indexMask = numOfEntries - 1;
+        static const uint64_t keyMask = ~((uint64_t) 0xffff);
+
+        static uint64_t table[numOfEntries];
+};
+
+#endif
@@ -1,7 +1,12 @@
 #include <vector>
 #include <array>
-#include <list>
 #include <cctype>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <utility>
+#include <algorithm>
 
 #include <iostream>
 
@@ -9,6 +14,7 @@
 #include "bitboard.h"
 #include "move.h"
 #include "constants.h"
+#include "eval.h"
 
 using namespace Bitboard;
 
@@ -21,6 +27,9 @@ uint64_t constexpr getPseudoRandomNumber(int n){
     return state;
 }
 
+//piece values for the static exchange evaluation, indexed by the piece constants in constants.h
+const int seePieceValues[7] = {0, 100, 315, 325, 500, 975, 10000};
+
 inline constexpr auto zobristPieces = lut<2*6*64>([] (std::size_t n) {
     return getPseudoRandomNumber(n);
 });
@@ -122,6 +131,8 @@ Game::Position::Position(std::string fen) {
     }
     index ++;
 
+    this->pliesFromNull = 0;
+
     this->fullMoveClock = 0;
     while(index < fen.length()) {
         c = fen.at(index);
@@ -129,12 +140,80 @@ Game::Position::Position(std::string fen) {
         this->fullMoveClock += c - 0x30;
         index++;
     }
+
+    this->hash = computePositionHash();
+    this->pawnHash = computePawnHash();
+    this->psqtScore = computePSQTScore();
+    this->gamePhase = computeGamePhase();
+}
+
+Game::Position* Game::allocateHistory() {
+    //aligned_alloc requires the size to be a multiple of the alignment
+    size_t size = ((historyCapacity * sizeof(Position) + 63) / 64) * 64;
+    Position *arena = (Position*) std::aligned_alloc(64, size);
+    if(arena == nullptr)
+        throw std::bad_alloc();
+    return arena;
+}
+
+void Game::allocateAccumulators() {
+    accumulators = (NNUE::Accumulator*) std::aligned_alloc(alignof(NNUE::Accumulator), historyCapacity * sizeof(NNUE::Accumulator));
+    if(accumulators == nullptr)
+        throw std::bad_alloc();
+
+    //the moves that lead to the existing positions are unknown, so their accumulators can only be computed from scratch
+    for(int i = 0; i <= pos - history; i++) {
+        accumulators[i].computed[WHITE] = false;
+        accumulators[i].computed[BLACK] = false;
+        accumulators[i].move = Move(0, 0);
+    }
+}
+
+void Game::invalidateAccumulator(Move move) {
+    if(accumulators == nullptr)
+        return;
+
+    NNUE::Accumulator& accumulator = accumulators[pos - history];
+    accumulator.computed[WHITE] = false;
+    accumulator.computed[BLACK] = false;
+    accumulator.move = move;
 }
 
 //game starts with the given position
 Game::Game(std::string fen) {  
-    this->history.push_back(Position(fen));
-    this->pos = &history.back();
+    this->history = allocateHistory();
+    this->accumulators = nullptr;
+    this->pos = new (history) Position(fen);
+}
+
+Game::Game(const Game& other) {
+    this->history = allocateHistory();
+    std::memcpy((void*) history, other.history, (other.pos - other.history + 1) * sizeof(Position));
+    this->pos = history + (other.pos - other.history);
+
+    //accumulators are not copied, as they may belong to a network that was replaced since. They are allocated and computed when needed
+    this->accumulators = nullptr;
+}
+
+Game::Game(Game&& other) {
+    this->history = other.history;
+    this->accumulators = other.accumulators;
+    this->pos = other.pos;
+    other.history = nullptr;
+    other.accumulators = nullptr;
+    other.pos = nullptr;
+}
+
+Game& Game::operator=(Game other) {
+    std::swap(history, other.history);
+    std::swap(accumulators, other.accumulators);
+    std::swap(pos, other.pos);
+    return *this;
+}
+
+Game::~Game() {
+    std::free(history);
+    std::free(accumulators);
 }
 
 
@@ -147,21 +226,11 @@ bool Game::isPositionDraw(int distanceToRoot) {
 
     int repetitions = 0;
     
-    std::list<Game::Position>::iterator it = history.end();
-    it --;
-    for(int i = 2; i < history.size() && i <= pos->halfMoveClock; i += 2) {
-        it--;
-        it--;
-
-        if(         it->castlingRights == pos->castlingRights
-                &&  it->enpassantFile == pos->enpassantFile
-                &&  it->diagonals == pos->diagonals
-                &&  it->filesAndRanks == pos->filesAndRanks
-                &&  it->kings == pos->kings
-                &&  it->knights == pos->knights
-                &&  it->ownPieces == pos->ownPieces
-                &&  it->pawns == pos->pawns) {
-                
+    //positions before a null move can't be repeated, as the null move isn't a legal move
+    for(int i = 2; i <= pos - history && i <= pos->halfMoveClock && i <= pos->pliesFromNull; i += 2) {
+        Position *previous = pos - i;
+
+        if(previous->hash == pos->hash) {
             repetitions++;
         }
 
@@ -219,15 +288,7 @@ uint64_t Game::Position::getPseudoLegalBishopMoves(char square, uint64_t occupie
 }
 
 uint64_t Game::Position::getBishopAttacks(char square, uint64_t occupiedSquares) {
-
-    uint64_t rayNorthWest = getBlockedRay<NORTH_WEST, true>(square, occupiedSquares);
-    uint64_t rayNorthEast = getBlockedRay<NORTH_EAST, true>(square, occupiedSquares);
-    uint64_t raySouthEast = getBlockedRay<SOUTH_EAST, true>(square, occupiedSquares);
-    uint64_t raySouthWest = getBlockedRay<SOUTH_WEST, true>(square, occupiedSquares);
-
-    uint64_t attacks = rayNorthEast | rayNorthWest | raySouthEast | raySouthWest;
-
-    return attacks;
+    return Bitboard::getBishopAttacks(square, occupiedSquares);
 }
 
 uint64_t Game::Position::getPseudoLegalRookMoves(char square, uint64_t occupiedSquares) {
@@ -239,21 +300,14 @@ uint64_t Game::Position::getPseudoLegalRookMoves(char square, uint64_t occupiedS
 }
 
 uint64_t Game::Position::getRookAttacks(char square, uint64_t occupiedSquares) {
-    
-    uint64_t rayNorth = getBlockedRay<NORTH, true>(square, occupiedSquares);
-    uint64_t rayEast = getBlockedRay<EAST, true>(square, occupiedSquares);
-    uint64_t raySouth = getBlockedRay<SOUTH, true>(square, occupiedSquares);
-    uint64_t rayWest = getBlockedRay<WEST, true>(square, occupiedSquares);
-
-    uint64_t attacks = rayEast | rayNorth | raySouth | rayWest;
-
-    return attacks;
+    return Bitboard::getRookAttacks(square, occupiedSquares);
 }
 
 //executes the given move
 void Game::makeMove(Move move) {
-    history.push_back(Position(pos, move));
-    pos = &history.back();
+    assert(pos - history + 1 < historyCapacity);
+    pos = new (pos + 1) Position(pos, move);
+    invalidateAccumulator(move);
 }
 
 Game::Position::Position(Game::Position *pos, Move move) {
@@ -473,13 +527,113 @@ Game::Position::Position(Game::Position *pos, Move move) {
         this->fullMoveClock = pos->fullMoveClock;
     }
 
+    this->pliesFromNull = pos->pliesFromNull + 1;
+
     this->whitesTurn = !pos->whitesTurn;
+
+    //update the hash incrementally
+    int ownColor = !pos->whitesTurn;
+    int enemyColor = pos->whitesTurn;
+
+    uint64_t newHash = pos->hash;
+    uint64_t newPawnHash = pos->pawnHash;
+
+    char movingPiece = pos->getPieceOnSquare(move.from);
+    char capturedPiece = pos->getPieceOnSquare(move.to);
+
+    newHash ^= zobristPieces[6*64*ownColor + 64*(movingPiece-1) + move.from];
+    newHash ^= zobristPieces[6*64*ownColor + 64*((move.flags ? move.flags : movingPiece)-1) + move.to];
+
+    if(movingPiece == PAWN) {
+        newPawnHash ^= zobristPieces[6*64*ownColor + 64*(PAWN-1) + move.from];
+        if(!move.flags)
+            newPawnHash ^= zobristPieces[6*64*ownColor + 64*(PAWN-1) + move.to];
+    }
+
+    //material and piece-square values are updated alongside the hash
+    char placedPiece = move.flags ? move.flags : movingPiece;
+    ScorePair newPSQTScore = pos->psqtScore - Eval::getPieceScore(movingPiece, move.from, ownColor)
+                                            + Eval::getPieceScore(placedPiece, move.to, ownColor);
+    char newGamePhase = pos->gamePhase + Eval::getPhaseWeight(placedPiece) - Eval::getPhaseWeight(movingPiece);
+
+    if(capturedPiece != NO_PIECE) {
+        newHash ^= zobristPieces[6*64*enemyColor + 64*(capturedPiece-1) + move.to];
+        if(capturedPiece == PAWN)
+            newPawnHash ^= zobristPieces[6*64*enemyColor + 64*(PAWN-1) + move.to];
+        newPSQTScore -= Eval::getPieceScore(capturedPiece, move.to, enemyColor);
+        newGamePhase -= Eval::getPhaseWeight(capturedPiece);
+    } else if(movingPiece == PAWN && (move.from - move.to) % 8 != 0) {
+        //en passant capture
+        char capturedPawnSquare = pos->whitesTurn ? move.to + 8 : move.to - 8;
+        newHash ^= zobristPieces[6*64*enemyColor + 64*(PAWN-1) + capturedPawnSquare];
+        newPawnHash ^= zobristPieces[6*64*enemyColor + 64*(PAWN-1) + capturedPawnSquare];
+        newPSQTScore -= Eval::getPieceScore(PAWN, capturedPawnSquare, enemyColor);
+    }
+
+    if(movingPiece == KING && (move.from - move.to == 2 || move.from - move.to == -2)) {
+        //castling: the rook moves as well
+        char rookFrom = (move.from - move.to == 2) ? move.from - 4 : move.from + 3;
+        char rookTo = (move.from - move.to == 2) ? move.from - 1 : move.from + 1;
+        newHash ^= zobristPieces[6*64*ownColor + 64*(ROOK-1) + rookFrom];
+        newHash ^= zobristPieces[6*64*ownColor + 64*(ROOK-1) + rookTo];
+        newPSQTScore += Eval::getPieceScore(ROOK, rookTo, ownColor) - Eval::getPieceScore(ROOK, rookFrom, ownColor);
+    }
+
+    if(pos->castlingRights != this->castlingRights)
+        newHash ^= zobristCastlingRights[pos->castlingRights] ^ zobristCastlingRights[this->castlingRights];
+
+    if(pos->enpassantFile != -1)
+        newHash ^= zobristEnPassat[pos->enpassantFile];
+    if(this->enpassantFile != -1)
+        newHash ^= zobristEnPassat[this->enpassantFile];
+
+    newHash ^= zobristPlayerToMove[0] ^ zobristPlayerToMove[1];
+
+    this->hash = newHash;
+    this->pawnHash = newPawnHash;
+    this->psqtScore = newPSQTScore;
+    this->gamePhase = newGamePhase;
+
+    #ifdef DEBUG_HASH
+        assert(this->hash == computePositionHash());
+        assert(this->pawnHash == computePawnHash());
+        assert(this->psqtScore == computePSQTScore());
+        assert(this->gamePhase == computeGamePhase());
+    #endif
+}
+
+void Game::makeNullMove() {
+    assert(pos - history + 1 < historyCapacity);
+    Position *previous = pos;
+    pos = new (pos + 1) Position(*previous);
+
+    uint64_t occupiedSquares = pos->pawns | pos->knights | pos->diagonals | pos->filesAndRanks | pos->kings;
+    pos->ownPieces = occupiedSquares & ~previous->ownPieces;
+
+    if(previous->enpassantFile != -1) {
+        pos->hash ^= zobristEnPassat[previous->enpassantFile];
+        pos->enpassantFile = -1;
+    }
+
+    pos->hash ^= zobristPlayerToMove[0] ^ zobristPlayerToMove[1];
+    pos->whitesTurn = !previous->whitesTurn;
+
+    if(!previous->whitesTurn) {
+        pos->fullMoveClock++;
+    }
+    pos->halfMoveClock = previous->halfMoveClock + 1;
+    pos->pliesFromNull = 0;
+
+    invalidateAccumulator(Move(0, 0));
+
+    #ifdef DEBUG_HASH
+        assert(pos->hash == pos->computePositionHash());
+    #endif
 }
 
 //reverts the last move
 void Game::undo() {
-    history.pop_back();
-    pos = &history.back();
+    pos--;
 }
 
 //determines wether the given move is a capture move
@@ -514,36 +668,190 @@ bool Game::Position::wouldKingBeInCheck(char kingSquare) {
     //our own king cannot block a attackRay in this context, since he then still would be in check
     uint64_t occupyingPieces = diagonals | filesAndRanks | knights | pawns | (kings & ~ownPieces);
 
-    uint64_t attackSquares;
-
-    attackSquares = getFirstBlockerInDirection<NORTH>(kingSquare, occupyingPieces)
-                  | getFirstBlockerInDirection<SOUTH>(kingSquare, occupyingPieces)
-                  | getFirstBlockerInDirection<WEST>(kingSquare, occupyingPieces)
-                  | getFirstBlockerInDirection<EAST>(kingSquare, occupyingPieces);
- 
-    if(attackSquares & (filesAndRanks & ~ownPieces))
+    if(getRookAttacks(kingSquare, occupyingPieces) & (filesAndRanks & ~ownPieces))
         return true;
 
-
-    attackSquares = getFirstBlockerInDirection<SOUTH_WEST>(kingSquare, occupyingPieces)
-                  | getFirstBlockerInDirection<SOUTH_EAST>(kingSquare, occupyingPieces)
-                  | getFirstBlockerInDirection<NORTH_EAST>(kingSquare, occupyingPieces)
-                  | getFirstBlockerInDirection<NORTH_WEST>(kingSquare, occupyingPieces);
-    
-    if(attackSquares & (diagonals & ~ownPieces))
+    if(getBishopAttacks(kingSquare, occupyingPieces) & (diagonals & ~ownPieces))
         return true;
 
     return false;
 }
 
 
+uint64_t Game::Position::getAttackersOfSquare(char square, uint64_t occupiedSquares) {
+    uint64_t whitePieces = this->whitesTurn ? ownPieces : ~ownPieces;
+
+    //a white pawn attacks the square, if a black pawn on the square would attack the pawn, and vice versa
+    return (  (getPawnAttacks(square, true) & pawns & whitePieces)
+            | (getPawnAttacks(square, false) & pawns & ~whitePieces)
+            | (getKnightMoveSquares(square) & knights)
+            | (getKingMoveSquares(square) & kings)
+            | (getBishopAttacks(square, occupiedSquares) & diagonals)
+            | (getRookAttacks(square, occupiedSquares) & filesAndRanks)) & occupiedSquares;
+}
+
+int Game::Position::see(Move move) {
+    uint64_t occupiedSquares = pawns | knights | diagonals | filesAndRanks | kings;
+
+    uint64_t pieceBoards[7] = {
+        0,
+        pawns,
+        knights,
+        diagonals & ~filesAndRanks,
+        filesAndRanks & ~diagonals,
+        diagonals & filesAndRanks,
+        kings
+    };
+
+    uint64_t piecesByColor[2]; //index 0: side to move, index 1: opponent
+    piecesByColor[0] = ownPieces;
+    piecesByColor[1] = occupiedSquares & ~ownPieces;
+
+    char attacker = getPieceOnSquare(move.from);
+    char victim = getPieceOnSquare(move.to);
+
+    //gain[i] is the material balance from the perspective of the side making the i-th capture, if the sequence stops after it
+    int gain[34];
+    int d = 0;
+
+    if(victim == NO_PIECE && attacker == PAWN && (move.from - move.to) % 8 != 0) {
+        //en passant: the captured pawn is not on the target square
+        gain[0] = seePieceValues[PAWN];
+        occupiedSquares &= ~getBitboard(this->whitesTurn ? move.to + 8 : move.to - 8);
+    } else {
+        gain[0] = seePieceValues[victim];
+    }
+
+    if(move.flags) {
+        //the promoted piece is the one that can be recaptured
+        gain[0] += seePieceValues[move.flags] - seePieceValues[PAWN];
+        attacker = move.flags;
+    }
+
+    uint64_t fromSquare = getBitboard(move.from);
+    uint64_t attackers = getAttackersOfSquare(move.to, occupiedSquares);
+
+    while(true) {
+        //remove the capturing piece and add sliders that attacked through it
+        occupiedSquares &= ~fromSquare;
+        attackers |= (getBishopAttacks(move.to, occupiedSquares) & diagonals) | (getRookAttacks(move.to, occupiedSquares) & filesAndRanks);
+        attackers &= occupiedSquares;
+
+        //find the least valuable attacker of the side to capture next
+        uint64_t sideAttackers = attackers & piecesByColor[(d + 1) & 1];
+        fromSquare = 0;
+        char nextAttacker = NO_PIECE;
+        for(char piece = PAWN; piece <= KING; piece++) {
+            uint64_t candidates = sideAttackers & pieceBoards[piece];
+            if(candidates) {
+                fromSquare = candidates & (~candidates + 1);
+                nextAttacker = piece;
+                break;
+            }
+        }
+
+        if(!fromSquare)
+            break;
+
+        d++;
+        gain[d] = seePieceValues[attacker] - gain[d-1];
+        attacker = nextAttacker;
+    }
+
+    //every side may stop the exchange instead of capturing
+    for(; d > 0; d--) {
+        gain[d-1] = -std::max(-gain[d-1], gain[d]);
+    }
+
+    return gain[0];
+}
+
+bool Game::Position::ownKingInCheck() {
+    return wouldKingBeInCheck(__builtin_ctzll(kings & ownPieces));
+}
+
+
 int Game::Position::getLegalMoves(Move *moveBuffer) {
     bool tmp;
-    return getLegalMoves<true>(tmp, moveBuffer);
+    return getLegalMoves<true, ALL_MOVES>(tmp, moveBuffer);
 }
 
 int Game::Position::getLegalMoves(bool& kingInCheck, Move *moveBuffer) {
-    return getLegalMoves<true>(kingInCheck, moveBuffer);
+    return getLegalMoves<true, ALL_MOVES>(kingInCheck, moveBuffer);
+}
+
+int Game::Position::getLegalCaptures(Move *moveBuffer) {
+    bool tmp;
+    return getLegalMoves<true, CAPTURES>(tmp, moveBuffer);
+}
+
+int Game::Position::getLegalQuietMoves(Move *moveBuffer) {
+    bool tmp;
+    return getLegalMoves<true, QUIET_MOVES>(tmp, moveBuffer);
+}
+
+bool Game::Position::isLegal(Move move) {
+    uint64_t fromMask = getBitboard(move.from);
+    uint64_t toMask = getBitboard(move.to);
+    uint64_t occupiedSquares = pawns | knights | diagonals | filesAndRanks | kings;
+
+    if(move.from == move.to || !(fromMask & ownPieces) || (toMask & ownPieces))
+        return false;
+
+    char piece = getPieceOnSquare(move.from);
+
+    if(piece == PAWN) {
+        bool promotionRank = this->whitesTurn ? (move.to < 8) : (move.to > 55);
+        if(promotionRank ? (move.flags < 2 || move.flags > 5) : (move.flags != 0))
+            return false;
+
+        char forward = this->whitesTurn ? -8 : 8;
+        bool onStartRank = this->whitesTurn ? (move.from >= 48 && move.from < 56) : (move.from >= 8 && move.from < 16);
+        char enpassantSquare = this->whitesTurn ? enpassantFile + 16 : enpassantFile + 40;
+
+        if(move.to == move.from + forward) {
+            if(toMask & occupiedSquares)
+                return false;
+        } else if(move.to == move.from + 2*forward) {
+            if(!onStartRank || (getBitboard(move.from + forward) & occupiedSquares) || (toMask & occupiedSquares))
+                return false;
+        } else if(getPawnAttacks(move.from, !this->whitesTurn) & toMask) {
+            if(!(toMask & occupiedSquares) && !(enpassantFile != -1 && move.to == enpassantSquare))
+                return false;
+        } else {
+            return false;
+        }
+    } else {
+        if(move.flags != 0)
+            return false;
+
+        uint64_t attacks;
+        if(piece == KNIGHT) {
+            attacks = getKnightMoveSquares(move.from);
+        } else if(piece == BISHOP) {
+            attacks = getBishopAttacks(move.from, occupiedSquares);
+        } else if(piece == ROOK) {
+            attacks = getRookAttacks(move.from, occupiedSquares);
+        } else if(piece == QUEEN) {
+            attacks = getBishopAttacks(move.from, occupiedSquares) | getRookAttacks(move.from, occupiedSquares);
+        } else {
+            if(move.from - move.to == 2 || move.from - move.to == -2) {
+                //castling
+                return moveLegal(move);
+            }
+            attacks = getKingMoveSquares(move.from);
+        }
+
+        if(!(attacks & toMask))
+            return false;
+    }
+
+    //the move is pseudo legal. Perform it and check if the king of the moving side is attacked afterwards
+    Position after(this, move);
+    after.ownPieces = (after.pawns | after.knights | after.diagonals | after.filesAndRanks | after.kings) & ~after.ownPieces;
+    after.whitesTurn = this->whitesTurn;
+
+    return !after.ownKingInCheck();
 }
 
 //helper functions
@@ -776,7 +1084,7 @@ inline void Game::Position::checkForPins(char& kingSquare, uint64_t& occupiedSqu
 
 
 
-template <bool returnMoves>
+template <bool returnMoves, char moveType>
 int Game::Position::getLegalMoves(bool& kingInCheck, Move *moveBuffer) {
     int numOfMoves = 0;
 
@@ -789,6 +1097,13 @@ int Game::Position::getLegalMoves(bool& kingInCheck, Move *moveBuffer) {
 
     uint64_t occupiedSquares = diagonals | filesAndRanks | kings | pawns | knights;
 
+    //restrict the target squares to the requested type of moves
+    if(moveType == CAPTURES) {
+        targetSquares &= occupiedSquares;
+    } else if(moveType == QUIET_MOVES) {
+        targetSquares &= ~occupiedSquares;
+    }
+
     //variables to keep track of pieces for which we haven't generated moves yet. 
     uint64_t pawnsToMove = pawns & ownPieces;
     uint64_t knightsToMove = knights & ownPieces;
@@ -884,6 +1199,11 @@ int Game::Position::getLegalMoves(bool& kingInCheck, Move *moveBuffer) {
 
     //king moves
     uint64_t kingMoveSquares = getKingMoveSquares(kingSquare) & ~ownPieces;
+    if(moveType == CAPTURES) {
+        kingMoveSquares &= occupiedSquares;
+    } else if(moveType == QUIET_MOVES) {
+        kingMoveSquares &= ~occupiedSquares;
+    }
     while(kingMoveSquares) {
         char target = __builtin_ctzll(kingMoveSquares);
         if(!wouldKingBeInCheck(target)) {
@@ -896,7 +1216,7 @@ int Game::Position::getLegalMoves(bool& kingInCheck, Move *moveBuffer) {
     }
 
     //en passant
-    if(enpassantFile != -1) {
+    if(moveType != QUIET_MOVES && enpassantFile != -1) {
         
         char capturedPawnSquare;
         char targetSquare;
@@ -945,7 +1265,7 @@ int Game::Position::getLegalMoves(bool& kingInCheck, Move *moveBuffer) {
     }
 
     //castling
-    if(!kingInCheck) {
+    if(moveType != CAPTURES && !kingInCheck) {
         //this array contains the squares that the king will cross during castling, which therefore must not be attacked by enemy pieces
         const char squaresNotToBeChecked[4][2] = {
                 {58, 59}, //long castling white
@@ -1021,6 +1341,10 @@ void Game::Position::printInternalRepresentation() {
 
 
 uint64_t Game::Position::getPositionHash() {
+    return hash;
+}
+
+uint64_t Game::Position::computePositionHash() {
     uint64_t hash = 0;
 
     //iterate through the 6 piece types
@@ -1075,6 +1399,35 @@ uint64_t Game::Position::getPositionHash() {
     return hash;
 }
 
+uint64_t Game::Position::computePawnHash() {
+    uint64_t pawnHash = 0;
+
+    foreach(pawns, [&](char square) {
+        bool black = (bool) (getBitboard(square) & ownPieces) != this->whitesTurn;
+        pawnHash ^= zobristPieces[6*64*black + 64*(PAWN-1) + square];
+    });
+
+    return pawnHash;
+}
+
+ScorePair Game::Position::computePSQTScore() {
+    ScorePair score;
+
+    uint64_t occupiedSquares = pawns | knights | diagonals | filesAndRanks | kings;
+    foreach(occupiedSquares, [&](char square) {
+        bool black = (bool) (getBitboard(square) & ownPieces) != this->whitesTurn;
+        score += Eval::getPieceScore(getPieceOnSquare(square), square, black);
+    });
+
+    return score;
+}
+
+char Game::Position::computeGamePhase() {
+    return 1 * __builtin_popcountll(knights | (diagonals & ~filesAndRanks))
+         + 2 * __builtin_popcountll(filesAndRanks & ~diagonals)
+         + 4 * __builtin_popcountll(filesAndRanks & diagonals);
+}
+
 char Game::Position::getPieceOnSquare(char square) {
     uint64_t mask = getBitboard(square);
     if(pawns & mask)
@@ -2,17 +2,26 @@
 #define GAME_H
 
 #include <string>
-#include <list>
 #include <cctype>
 
 #include "constants.h"
 #include "move.h"
+#include "scorepair.h"
+#include "nnue.h"
 
 class Game {
     public:
+
+        static const int maxGameLength = 12000; //in half moves. The longest possible game is shorter than this
+        static const int maxSearchPly = 256; //maximum number of moves that may be made on top of the game during a search
         
         Game(std::string fen = START_POSITION_FEN);
 
+        Game(const Game& other);
+        Game(Game&& other);
+        Game& operator=(Game other);
+        ~Game();
+
         /**
          * performs the specified move
          * @param move a legal move (as can be checked with MoveLegal()) that is to be executed on the current position
@@ -20,7 +29,14 @@ class Game {
         void makeMove(Move move);
 
         /**
-         * undoes the last move made with playMove() or nullmove()
+         * passes the turn to the opponent without moving a piece. The en passant file is cleared. The half move clock counts the
+         * null move like any reversible move, but since a null move is not a legal chess move, repetitions are never detected across it.
+         * Must not be used when the side to move is in check
+         */
+        void makeNullMove();
+
+        /**
+         * undoes the last move made with makeMove() or makeNullMove()
          */
         void undo();
 
@@ -42,11 +58,18 @@ class Game {
                 uint64_t diagonals;
                 uint64_t knights;
                 uint64_t kings;
+
+                uint64_t hash; //zobrist hash of the position, updated incrementally when making moves
+                uint64_t pawnHash; //zobrist hash of the pawns of both colors only, used to cache the pawn structure evaluation
+
+                ScorePair psqtScore; //material and piece-square values of all pieces from whites perspective, updated incrementally
+                char gamePhase; //1 per knight and bishop, 2 per rook, 4 per queen. 24 in the starting position
                 
                 short fullMoveClock; //current move number. Starts at one and is incremented after blacks turn
                 char castlingRights; //bit 0: white long, 1: white short, 2: black long, 3: block short
                 char enpassantFile; //-1 for none, if there is a pawn were the en-passant rule is applicable 0-7 are used
                 char halfMoveClock; //number of half moves since capture or pawn advance (relevant for 50 move rule)
+                short pliesFromNull; //number of half moves since the last null move or the start position, repetitions are only searched within them
                 bool whitesTurn;
                 
 
@@ -60,6 +83,21 @@ class Game {
 
                 uint64_t getPositionHash();
 
+                /**
+                 * computes the zobrist hash from scratch. Used to initialize the hash and, when compiled with -DDEBUG_HASH,
+                 * to verify the incrementally updated hash after every move
+                 */
+                uint64_t computePositionHash();
+
+                uint64_t computePawnHash();
+
+                /**
+                 * computes the material and piece-square score and the game phase from scratch. Used to initialize them and,
+                 * when compiled with -DDEBUG_HASH, to verify the incremental updates
+                 */
+                ScorePair computePSQTScore();
+                char computeGamePhase();
+
                 bool wouldKingBeInCheck(char square);
 
                 bool ownKingInCheck();
@@ -67,6 +105,24 @@ class Game {
                 bool isCapture(Move);
                 bool moveLegal(Move move);
 
+                /**
+                 * checks if an arbitrary move (for example a hash move or a killer move) is legal, without generating all legal moves.
+                 * Only castling moves fall back to the full move generation
+                 */
+                bool isLegal(Move move);
+
+                /**
+                 * static exchange evaluation: the material balance of the exchange sequence on the target square of the given
+                 * capture, if both sides always recapture with their least valuable piece and may stop capturing at any time
+                 * @returns the expected material gain (in centipawns) for the side to move
+                 */
+                int see(Move move);
+
+                /**
+                 * @returns a bitboard with all pieces of both colors that attack the given square, given the occupied squares
+                 */
+                uint64_t getAttackersOfSquare(char square, uint64_t occupiedSquares);
+
 
                 /**
                  * @param moveBuffer is used to return legal moves in the current position.
@@ -81,6 +137,18 @@ class Game {
                  */
                 int getLegalMoves(bool& kingInCheck, Move *moveBuffer);
 
+                /**
+                 * @param moveBuffer is used to return the legal captures (including en passant and capturing promotions)
+                 * @returns the number of legal captures in the current position
+                 */
+                int getLegalCaptures(Move *moveBuffer);
+
+                /**
+                 * @param moveBuffer is used to return the legal moves to empty squares (including castling and non capturing promotions)
+                 * @returns the number of legal quiet moves in the current position
+                 */
+                int getLegalQuietMoves(Move *moveBuffer);
+
 
                 uint64_t getPseudoLegalBishopMoves(char square, uint64_t occupiedSquares);
                 uint64_t getPseudoLegalBishopMoves(char square, uint64_t occupiedSquares, uint64_t ownPieces);
@@ -100,7 +168,7 @@ class Game {
                 template<char direction>
                 void lookForCheck(uint64_t& checkBlockingSquares, uint64_t occupiedSquares, char kingSquare);
 
-                template<bool returnMoves>
+                template<bool returnMoves, char moveType>
                 int getLegalMoves(bool& kingInCheck, Move *moveBuffer);
 
 
@@ -113,7 +181,23 @@ class Game {
         Position *pos; //pointer to the current position
 
     private:
-        std::list<Position> history;
+        static const int historyCapacity = maxGameLength + maxSearchPly;
+
+        //positions of the game, stored contiguously in a cache line aligned arena. history[0] is the starting position,
+        //pos points to the last entry. makeMove() and undo() only move pos up and down the stack
+        Position *history;
+
+        //first layer of the neural network for every position in history, at the same index. Only allocated and computed when
+        //needed by NNUE::evaluate(), so games evaluated by the hand-crafted evaluation don't reserve the memory. nullptr until then
+        NNUE::Accumulator *accumulators;
+
+        static Position *allocateHistory();
+        void allocateAccumulators();
+
+        //marks the accumulator of the current position as outdated, after the given move lead to it
+        void invalidateAccumulator(Move move);
+
+        friend class NNUE;
 
 };
 
@@ -0,0 +1,142 @@
+#include "movepicker.h"
+#include "game.h"
+#include "move.h"
+
+MovePicker::MovePicker(Game::Position *pos, Move *moveBuffer, Move ttMove, Move *killers, Move counterMove, const short (*history)[64]) {
+    this->pos = pos;
+    this->moves = moveBuffer;
+    this->ttMove = ttMove;
+    this->killers[0] = killers[0];
+    this->killers[1] = killers[1];
+    this->counterMove = counterMove;
+    this->history = history;
+
+    this->stage = TT_MOVE;
+    this->current = 0;
+    this->numOfCaptures = 0;
+    this->numOfQuiets = 0;
+    this->numOfBadCaptures = 0;
+    this->killerIndex = 0;
+}
+
+int MovePicker::getMVV_LVA_eval(Game::Position* pos, Move move) {
+    char victim = pos->getPieceOnSquare(move.to);
+    char aggressor = pos->getPieceOnSquare(move.from);
+    return 10*victim-aggressor;
+}
+
+//a capture is good, if it does not lose material in the exchange on the target square
+bool MovePicker::isGoodCapture(Move move) {
+    return pos->see(move) >= 0;
+}
+
+void MovePicker::selectBest(int end) {
+    int best = current;
+    for(int i = current + 1; i < end; i++) {
+        if(moveScores[i] > moveScores[best])
+            best = i;
+    }
+    Move bestMove = moves[best];
+    moves[best] = moves[current];
+    moves[current] = bestMove;
+    int bestScore = moveScores[best];
+    moveScores[best] = moveScores[current];
+    moveScores[current] = bestScore;
+}
+
+bool MovePicker::next(Move& move) {
+    switch(stage) {
+        case TT_MOVE:
+            stage = GENERATE_CAPTURES;
+            if(pos->isLegal(ttMove)) {
+                move = ttMove;
+                return true;
+            }
+            [[fallthrough]];
+
+        case GENERATE_CAPTURES:
+            numOfCaptures = pos->getLegalCaptures(moves);
+            for(int i = 0; i < numOfCaptures; i++) {
+                moveScores[i] = getMVV_LVA_eval(pos, moves[i]);
+            }
+            current = 0;
+            stage = GOOD_CAPTURES;
+            [[fallthrough]];
+
+        case GOOD_CAPTURES:
+            while(current < numOfCaptures) {
+                //selection sort, one move at a time
+                selectBest(numOfCaptures);
+                Move capture = moves[current++];
+
+                if(capture == ttMove)
+                    continue;
+
+                if(!isGoodCapture(capture)) {
+                    //bad captures are searched last. They are stored in the already processed part of the buffer
+                    moves[numOfBadCaptures++] = capture;
+                    continue;
+                }
+
+                move = capture;
+                return true;
+            }
+            stage = KILLERS;
+            [[fallthrough]];
+
+        case KILLERS:
+            while(killerIndex < 2) {
+                Move killer = killers[killerIndex++];
+                if(killer != ttMove && (killerIndex == 1 || killer != killers[0]) && !pos->isCapture(killer) && pos->isLegal(killer)) {
+                    move = killer;
+                    return true;
+                }
+            }
+            stage = COUNTER_MOVE;
+            [[fallthrough]];
+
+        case COUNTER_MOVE:
+            stage = GENERATE_QUIETS;
+            if(counterMove != ttMove && counterMove != killers[0] && counterMove != killers[1]
+                    && !pos->isCapture(counterMove) && pos->isLegal(counterMove)) {
+                move = counterMove;
+                return true;
+            }
+            [[fallthrough]];
+
+        case GENERATE_QUIETS:
+            numOfQuiets = pos->getLegalQuietMoves(moves + numOfCaptures);
+            for(int i = numOfCaptures; i < numOfCaptures + numOfQuiets; i++) {
+                moveScores[i] = history[moves[i].from][moves[i].to];
+            }
+            current = numOfCaptures;
+            stage = QUIETS;
+            [[fallthrough]];
+
+        case QUIETS:
+            while(current < numOfCaptures + numOfQuiets) {
+                selectBest(numOfCaptures + numOfQuiets);
+                Move quiet = moves[current++];
+                if(quiet == ttMove || quiet == killers[0] || quiet == killers[1] || quiet == counterMove)
+                    continue;
+
+                move = quiet;
+                return true;
+            }
+            current = 0;
+            stage = BAD_CAPTURES;
+            [[fallthrough]];
+
+        case BAD_CAPTURES:
+            if(current < numOfBadCaptures) {
+                move = moves[current++];
+                return true;
+            }
+            stage = DONE;
+            [[fallthrough]];
+
+        case DONE:
+            return false;
+    }
+    return false;
+}
@@ -0,0 +1,72 @@
+#ifndef MOVEPICKER_H
+#define MOVEPICKER_H
+
+#include "game.h"
+#include "move.h"
+
+/**
+ * returns the legal moves of a position one at a time, in the order
+ * hash move, good captures, killer moves, counter move, quiet moves (sorted by their history score), bad captures.
+ * Moves are generated lazily: the hash move and the killer moves are checked for legality individually,
+ * captures are only generated after the hash move has been searched and quiet moves only after all good captures, killer moves and the counter move.
+ * A node that fails high early therefore skips most of the move generation.
+ */
+class MovePicker {
+    public:
+
+        /**
+         * @param moveBuffer is used to store the generated moves. Must have space for 343 moves
+         * @param ttMove the move stored in the transposition table. Move(0, 0) if there is none
+         * @param killers the two killer moves of the current ply
+         * @param counterMove the move that refuted the previous move last time. Move(0, 0) if there is none
+         * @param history the history scores of the side to move, indexed by from and to square
+         */
+        MovePicker(Game::Position *pos, Move *moveBuffer, Move ttMove, Move *killers, Move counterMove, const short (*history)[64]);
+
+        /**
+         * @param move is set to the next move
+         * @returns false if all moves have been returned
+         */
+        bool next(Move& move);
+
+        static int getMVV_LVA_eval(Game::Position* pos, Move move);
+
+    private:
+        enum Stage {
+            TT_MOVE,
+            GENERATE_CAPTURES,
+            GOOD_CAPTURES,
+            KILLERS,
+            COUNTER_MOVE,
+            GENERATE_QUIETS,
+            QUIETS,
+            BAD_CAPTURES,
+            DONE
+        };
+
+        Stage stage;
+
+        Game::Position *pos;
+        Move *moves;
+
+        Move ttMove;
+        Move killers[2];
+        Move counterMove;
+
+        const short (*history)[64];
+
+        int current;
+        int numOfCaptures;
+        int numOfQuiets;
+        int numOfBadCaptures;
+        int killerIndex;
+
+        int moveScores[343]; //MVV-LVA scores of the captures and history scores of the quiet moves, at the same index as the move
+
+        bool isGoodCapture(Move move);
+
+        //moves the highest scored move in [current, end) to index current
+        void selectBest(int end);
+};
+
+#endif
@@ -0,0 +1,340 @@
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <algorithm>
+#include <cassert>
+
+#if defined(__AVX2__) || defined(__SSSE3__)
+    #include <immintrin.h>
+#elif defined(__SSE2__)
+    #include <emmintrin.h>
+#endif
+
+#include "nnue.h"
+#include "game.h"
+#include "bitboard.h"
+#include "constants.h"
+
+using namespace Bitboard;
+
+NNUE::Network *NNUE::network = nullptr;
+
+
+//file format
+static const uint32_t fileVersion = 0x7AF32F16;
+
+//the quantized hidden layers are scaled by 64, the output by 16
+static const int weightScaleBits = 6;
+static const int outputScale = 16;
+
+//the output of the network is in units where a pawn in the endgame is worth 208
+static const int networkPawnValue = 208;
+
+//evaluations stay clear of mate scores
+static const int maxEvaluation = 10000;
+
+
+//kernels
+
+//dst = src + the weights of the added features - the weights of the removed features
+static void applyFeatures(int16_t *dst, const int16_t *src, const int16_t **added, int numAdded, const int16_t **removed, int numRemoved) {
+#if defined(__AVX2__)
+    for(int i = 0; i < NNUE::hiddenSize; i += 16) {
+        __m256i values = _mm256_load_si256((const __m256i*) (src + i));
+        for(int j = 0; j < numRemoved; j++)
+            values = _mm256_sub_epi16(values, _mm256_load_si256((const __m256i*) (removed[j] + i)));
+        for(int j = 0; j < numAdded; j++)
+            values = _mm256_add_epi16(values, _mm256_load_si256((const __m256i*) (added[j] + i)));
+        _mm256_store_si256((__m256i*) (dst + i), values);
+    }
+#elif defined(__SSE2__)
+    for(int i = 0; i < NNUE::hiddenSize; i += 8) {
+        __m128i values = _mm_load_si128((const __m128i*) (src + i));
+        for(int j = 0; j < numRemoved; j++)
+            values = _mm_sub_epi16(values, _mm_load_si128((const __m128i*) (removed[j] + i)));
+        for(int j = 0; j < numAdded; j++)
+            values = _mm_add_epi16(values, _mm_load_si128((const __m128i*) (added[j] + i)));
+        _mm_store_si128((__m128i*) (dst + i), values);
+    }
+#else
+    for(int i = 0; i < NNUE::hiddenSize; i++) {
+        int16_t value = src[i];
+        for(int j = 0; j < numRemoved; j++)
+            value -= removed[j][i];
+        for(int j = 0; j < numAdded; j++)
+            value += added[j][i];
+        dst[i] = value;
+    }
+#endif
+}
+
+//clamps the accumulator values to [0, 127]
+static void clippedReLU16(uint8_t *dst, const int16_t *src) {
+#if defined(__AVX2__)
+    const __m256i max = _mm256_set1_epi8(127);
+    for(int i = 0; i < NNUE::hiddenSize; i += 32) {
+        __m256i packed = _mm256_packus_epi16(_mm256_load_si256((const __m256i*) (src + i)), _mm256_load_si256((const __m256i*) (src + i + 16)));
+        //packing works on 128 bit lanes, which have to be put back into order
+        packed = _mm256_permute4x64_epi64(_mm256_min_epu8(packed, max), 0xd8);
+        _mm256_store_si256((__m256i*) (dst + i), packed);
+    }
+#elif defined(__SSE2__)
+    const __m128i max = _mm_set1_epi8(127);
+    for(int i = 0; i < NNUE::hiddenSize; i += 16) {
+        __m128i packed = _mm_packus_epi16(_mm_load_si128((const __m128i*) (src + i)), _mm_load_si128((const __m128i*) (src + i + 8)));
+        _mm_store_si128((__m128i*) (dst + i), _mm_min_epu8(packed, max));
+    }
+#else
+    for(int i = 0; i < NNUE::hiddenSize; i++) {
+        dst[i] = std::clamp((int) src[i], 0, 127);
+    }
+#endif
+}
+
+//output[i] = biases[i] + sum of weights[i][j] * input[j]
+template<int inputs>
+static void affine(int32_t *output, const uint8_t *input, const int8_t (*weights)[inputs], const int32_t *biases, int outputs) {
+#if defined(__AVX2__)
+    const __m256i ones = _mm256_set1_epi16(1);
+    for(int i = 0; i < outputs; i++) {
+        __m256i sum = _mm256_setzero_si256();
+        for(int j = 0; j < inputs; j += 32) {
+            //the inputs are at most 127, so that the pairwise sums of the products can't saturate
+            __m256i products = _mm256_maddubs_epi16(_mm256_load_si256((const __m256i*) (input + j)), _mm256_load_si256((const __m256i*) (weights[i] + j)));
+            sum = _mm256_add_epi32(sum, _mm256_madd_epi16(products, ones));
+        }
+        __m128i sum128 = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+        sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0x4e));
+        sum128 = _mm_add_epi32(sum128, _mm_shuffle_epi32(sum128, 0xb1));
+        output[i] = biases[i] + _mm_cvtsi128_si32(sum128);
+    }
+#elif defined(__SSSE3__)
+    const __m128i ones = _mm_set1_epi16(1);
+    for(int i = 0; i < outputs; i++) {
+        __m128i sum = _mm_setzero_si128();
+        for(int j = 0; j < inputs; j += 16) {
+            __m128i products = _mm_maddubs_epi16(_mm_load_si128((const __m128i*) (input + j)), _mm_load_si128((const __m128i*) (weights[i] + j)));
+            sum = _mm_add_epi32(sum, _mm_madd_epi16(products, ones));
+        }
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0x4e));
+        sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, 0xb1));
+        output[i] = biases[i] + _mm_cvtsi128_si32(sum);
+    }
+#else
+    for(int i = 0; i < outputs; i++) {
+        int32_t sum = biases[i];
+        for(int j = 0; j < inputs; j++) {
+            sum += input[j] * weights[i][j];
+        }
+        output[i] = sum;
+    }
+#endif
+}
+
+//scales the outputs of a hidden layer down and clamps them to [0, 127]
+static void clippedReLU32(uint8_t *dst, const int32_t *src, int size) {
+    for(int i = 0; i < size; i++) {
+        dst[i] = std::clamp(src[i] >> weightScaleBits, 0, 127);
+    }
+}
+
+
+bool NNUE::load(std::string fileName) {
+    std::ifstream file(fileName, std::ios::binary);
+    if(!file)
+        return false;
+
+    uint32_t version, hash, descriptionSize;
+    file.read((char*) &version, sizeof(version));
+    file.read((char*) &hash, sizeof(hash));
+    file.read((char*) &descriptionSize, sizeof(descriptionSize));
+    if(!file || version != fileVersion)
+        return false;
+
+    file.ignore(descriptionSize);
+
+    Network *newNetwork = (Network*) std::aligned_alloc(alignof(Network), ((sizeof(Network) + alignof(Network) - 1) / alignof(Network)) * alignof(Network));
+    if(newNetwork == nullptr)
+        return false;
+
+    //every part of the network is preceded by a hash of its architecture, which is not checked. The exact file size is checked instead
+    file.read((char*) &hash, sizeof(hash));
+    file.read((char*) newNetwork->featureBiases, sizeof(newNetwork->featureBiases));
+    file.read((char*) newNetwork->featureWeights, sizeof(newNetwork->featureWeights));
+
+    file.read((char*) &hash, sizeof(hash));
+    file.read((char*) newNetwork->l1Biases, sizeof(newNetwork->l1Biases));
+    file.read((char*) newNetwork->l1Weights, sizeof(newNetwork->l1Weights));
+    file.read((char*) newNetwork->l2Biases, sizeof(newNetwork->l2Biases));
+    file.read((char*) newNetwork->l2Weights, sizeof(newNetwork->l2Weights));
+    file.read((char*) &newNetwork->outputBias, sizeof(newNetwork->outputBias));
+    file.read((char*) newNetwork->outputWeights, sizeof(newNetwork->outputWeights));
+
+    if(!file || file.peek() != std::ifstream::traits_type::eof()) {
+        std::free(newNetwork);
+        return false;
+    }
+
+    std::free(network);
+    network = newNetwork;
+    return true;
+}
+
+bool NNUE::isLoaded() {
+    return network != nullptr;
+}
+
+int NNUE::getFeatureIndex(int perspective, char kingSquare, char pieceType, bool pieceIsBlack, char square) {
+    //networks are trained with a1 as square 0 and the board rotated for black. Here a8 is square 0
+    char flip = perspective == WHITE ? 56 : 7;
+    int pieceIndex = 1 + 128 * (pieceType - 1) + 64 * (pieceIsBlack != (perspective == BLACK));
+    return (square ^ flip) + pieceIndex + 641 * (kingSquare ^ flip);
+}
+
+void NNUE::refreshAccumulator(Game *game, int index, int perspective) {
+    Game::Position *pos = game->history + index;
+
+    uint64_t occupiedSquares = pos->pawns | pos->knights | pos->diagonals | pos->filesAndRanks | pos->kings;
+    uint64_t blackPieces = pos->whitesTurn ? occupiedSquares & ~pos->ownPieces : pos->ownPieces;
+    uint64_t perspectivePieces = perspective == BLACK ? blackPieces : occupiedSquares & ~blackPieces;
+    char kingSquare = __builtin_ctzll(pos->kings & perspectivePieces);
+
+    //at most 30 pieces besides the kings
+    const int16_t *added[30];
+    int numAdded = 0;
+    foreach(occupiedSquares & ~pos->kings, [&](char square) {
+        bool black = getBitboard(square) & blackPieces;
+        added[numAdded++] = network->featureWeights[getFeatureIndex(perspective, kingSquare, pos->getPieceOnSquare(square), black, square)];
+    });
+
+    Accumulator& accumulator = game->accumulators[index];
+    applyFeatures(accumulator.values[perspective], network->featureBiases, added, numAdded, nullptr, 0);
+    accumulator.computed[perspective] = true;
+}
+
+void NNUE::updateAccumulator(Game *game, int index, int perspective) {
+    Game::Position *previous = game->history + index - 1;
+    Game::Position *pos = game->history + index;
+    Accumulator& accumulator = game->accumulators[index];
+    const int16_t *previousValues = game->accumulators[index - 1].values[perspective];
+    Move move = accumulator.move;
+
+    if(move == Move(0, 0)) {
+        //null move
+        std::memcpy(accumulator.values[perspective], previousValues, sizeof(accumulator.values[perspective]));
+        accumulator.computed[perspective] = true;
+        return;
+    }
+
+    uint64_t occupiedSquares = pos->pawns | pos->knights | pos->diagonals | pos->filesAndRanks | pos->kings;
+    uint64_t perspectivePieces = (perspective == BLACK) == pos->whitesTurn ? occupiedSquares & ~pos->ownPieces : pos->ownPieces;
+    char kingSquare = __builtin_ctzll(pos->kings & perspectivePieces);
+
+    bool moverIsBlack = !previous->whitesTurn;
+    char movingPiece = previous->getPieceOnSquare(move.from);
+    char capturedPiece = previous->getPieceOnSquare(move.to);
+    char placedPiece = move.flags ? move.flags : movingPiece;
+
+    const int16_t *added[2];
+    const int16_t *removed[2];
+    int numAdded = 0;
+    int numRemoved = 0;
+
+    //a king move of the perspective requires a refresh, so a moving king always belongs to the other side and is no feature
+    if(movingPiece != KING) {
+        removed[numRemoved++] = network->featureWeights[getFeatureIndex(perspective, kingSquare, movingPiece, moverIsBlack, move.from)];
+        added[numAdded++] = network->featureWeights[getFeatureIndex(perspective, kingSquare, placedPiece, moverIsBlack, move.to)];
+    }
+
+    if(capturedPiece != NO_PIECE) {
+        removed[numRemoved++] = network->featureWeights[getFeatureIndex(perspective, kingSquare, capturedPiece, !moverIsBlack, move.to)];
+    } else if(movingPiece == PAWN && (move.from - move.to) % 8 != 0) {
+        //en passant capture
+        char capturedPawnSquare = previous->whitesTurn ? move.to + 8 : move.to - 8;
+        removed[numRemoved++] = network->featureWeights[getFeatureIndex(perspective, kingSquare, PAWN, !moverIsBlack, capturedPawnSquare)];
+    }
+
+    if(movingPiece == KING && (move.from - move.to == 2 || move.from - move.to == -2)) {
+        //castling: the rook moves as well
+        char rookFrom = (move.from - move.to == 2) ? move.from - 4 : move.from + 3;
+        char rookTo = (move.from - move.to == 2) ? move.from - 1 : move.from + 1;
+        removed[numRemoved++] = network->featureWeights[getFeatureIndex(perspective, kingSquare, ROOK, moverIsBlack, rookFrom)];
+        added[numAdded++] = network->featureWeights[getFeatureIndex(perspective, kingSquare, ROOK, moverIsBlack, rookTo)];
+    }
+
+    applyFeatures(accumulator.values[perspective], previousValues, added, numAdded, removed, numRemoved);
+    accumulator.computed[perspective] = true;
+}
+
+void NNUE::updateAccumulators(Game *game) {
+    int current = game->pos - game->history;
+
+    for(int perspective = WHITE; perspective <= BLACK; perspective++) {
+        //find the last position with a computed accumulator, that can be reached by incremental updates
+        int index = current;
+        while(!game->accumulators[index].computed[perspective]) {
+            if(index == 0 || current - index >= maxUpdateDistance)
+                break;
+
+            Move move = game->accumulators[index].move;
+            Game::Position *previous = game->history + index - 1;
+            if(move != Move(0, 0) && (previous->whitesTurn == (perspective == WHITE)) && previous->getPieceOnSquare(move.from) == KING)
+                break; //all features of the perspective depend on the position of its king
+
+            index--;
+        }
+
+        if(!game->accumulators[index].computed[perspective]) {
+            refreshAccumulator(game, current, perspective);
+            continue;
+        }
+
+        for(int i = index + 1; i <= current; i++) {
+            updateAccumulator(game, i, perspective);
+        }
+    }
+
+    #ifdef DEBUG_HASH
+        Accumulator updated = game->accumulators[current];
+        refreshAccumulator(game, current, WHITE);
+        refreshAccumulator(game, current, BLACK);
+        assert(std::memcmp(updated.values, game->accumulators[current].values, sizeof(updated.values)) == 0);
+    #endif
+}
+
+int32_t NNUE::propagate(const Accumulator& accumulator, int sideToMove) {
+    alignas(64) uint8_t transformed[2 * hiddenSize];
+    alignas(64) int32_t l2Sums[l2Size];
+    alignas(64) uint8_t l2Input[l2Size];
+    alignas(64) int32_t l3Sums[l3Size];
+    alignas(64) uint8_t l3Input[l3Size];
+
+    //the perspective of the side to move comes first
+    clippedReLU16(transformed, accumulator.values[sideToMove]);
+    clippedReLU16(transformed + hiddenSize, accumulator.values[!sideToMove]);
+
+    affine<2 * hiddenSize>(l2Sums, transformed, network->l1Weights, network->l1Biases, l2Size);
+    clippedReLU32(l2Input, l2Sums, l2Size);
+
+    affine<l2Size>(l3Sums, l2Input, network->l2Weights, network->l2Biases, l3Size);
+    clippedReLU32(l3Input, l3Sums, l3Size);
+
+    int32_t output;
+    affine<l3Size>(&output, l3Input, &network->outputWeights, &network->outputBias, 1);
+    return output;
+}
+
+short NNUE::evaluate(Game *game) {
+    if(game->accumulators == nullptr)
+        game->allocateAccumulators();
+
+    updateAccumulators(game);
+
+    int sideToMove = game->pos->whitesTurn ? WHITE : BLACK;
+    int32_t output = propagate(game->accumulators[game->pos - game->history], sideToMove);
+
+    //convert to centipawns
+    int score = (output / outputScale) * 100 / networkPawnValue;
+    return std::clamp(score, -maxEvaluation, maxEvaluation);
+}
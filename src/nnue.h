@@ -0,0 +1,81 @@
+#ifndef NNUE_H
+#define NNUE_H
+
+#include <cstdint>
+#include <string>
+
+#include "move.h"
+
+class Game;
+
+/**
+ * efficiently updatable neural network evaluation, an alternative to the hand-crafted evaluation in eval.cpp.
+ * Networks use the HalfKP 256x2-32-32 layout: every input feature is the combination of the square of one king
+ * with the square and type of a non king piece. The first layer (feature transformer) is kept in an accumulator for both
+ * perspectives, which only changes for the few pieces that moved. The accumulators are stored in a stack parallel to the
+ * positions of the game and are brought up to date lazily, when a position is evaluated.
+ * The following layers are quantized to 8 bits and evaluated with AVX2 or SSSE3 kernels if available
+ */
+class NNUE {
+    public:
+        static const int inputSize = 64 * 641; //king square * (10 piece types * 64 squares + 1)
+        static const int hiddenSize = 256; //per perspective
+        static const int l2Size = 32;
+        static const int l3Size = 32;
+
+        /**
+         * the first layer of the network for both perspectives, of one position in the game
+         */
+        struct alignas(64) Accumulator {
+            int16_t values[2][hiddenSize]; //indexed by perspective (WHITE or BLACK)
+            bool computed[2];
+            Move move; //the move that lead to this position. Move(0, 0) for null moves
+        };
+
+        /**
+         * loads the weights of a network from a file in the HalfKP 256x2-32-32 format
+         * @returns false if the file could not be read or doesn't contain a network of the expected size. The previously loaded network is kept in that case
+         */
+        static bool load(std::string fileName);
+
+        static bool isLoaded();
+
+        /**
+         * evaluates the current position of the game, from the view of the side to move.
+         * Must only be called if a network is loaded. The accumulators of the game are allocated on the first call
+         */
+        static short evaluate(Game *game);
+
+    private:
+        struct Network {
+            alignas(64) int16_t featureBiases[hiddenSize];
+            alignas(64) int16_t featureWeights[inputSize][hiddenSize];
+
+            alignas(64) int32_t l1Biases[l2Size];
+            alignas(64) int8_t l1Weights[l2Size][2 * hiddenSize];
+
+            alignas(64) int32_t l2Biases[l3Size];
+            alignas(64) int8_t l2Weights[l3Size][l2Size];
+
+            int32_t outputBias;
+            alignas(64) int8_t outputWeights[l3Size];
+        };
+
+        static Network *network;
+
+        //incremental updates over more plies than this are slower than computing the accumulator from scratch
+        static const int maxUpdateDistance = 8;
+
+        static int getFeatureIndex(int perspective, char kingSquare, char pieceType, bool pieceIsBlack, char square);
+
+        static void refreshAccumulator(Game *game, int index, int perspective);
+
+        //applies the move stored in the accumulator at index to the accumulator at index - 1
+        static void updateAccumulator(Game *game, int index, int perspective);
+
+        static void updateAccumulators(Game *game);
+
+        static int32_t propagate(const Accumulator& accumulator, int sideToMove);
+};
+
+#endif
@@ -0,0 +1,23 @@
+#include <cstdint>
+#include <cstdlib>
+
+#include "pawntable.h"
+
+PawnTable::PawnTable(int sizeInMiB) {
+    this->sizeInMiB = sizeInMiB;
+    numOfEntries = ((uint64_t) 1048576) * ((uint64_t) sizeInMiB) / sizeof(Entry);
+    entries = (Entry *) aligned_alloc(alignof(Entry), numOfEntries * sizeof(Entry));
+
+    //an empty entry must not match any position. A key of zero would match positions without pawns
+    for(uint64_t i = 0; i < numOfEntries; i++) {
+        entries[i].key = ~((uint64_t) 0);
+    }
+}
+
+PawnTable::~PawnTable() {
+    free(entries);
+}
+
+int PawnTable::getSizeInMiB() {
+    return sizeInMiB;
+}
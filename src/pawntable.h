@@ -0,0 +1,40 @@
+#ifndef PAWNTABLE_H
+#define PAWNTABLE_H
+
+#include <cstdint>
+
+#include "eval.h"
+
+/**
+ * caches the evaluation of the pawn structure, which only depends on the pawns and rarely changes between neighbouring nodes.
+ * Every search thread has its own table, so no synchronization is needed
+ */
+class PawnTable {
+    public:
+        struct alignas(64) Entry {
+            uint64_t key; //pawn hash of the position
+            PawnStructure pawns;
+        };
+
+        PawnTable(int sizeInMiB);
+        ~PawnTable();
+
+        PawnTable(const PawnTable&) = delete;
+        PawnTable& operator=(const PawnTable&) = delete;
+
+        /**
+         * @returns the entry the position with the given pawn hash is stored in. It contains the position only if the key matches
+         */
+        inline Entry *getEntry(uint64_t pawnHash) {
+            return &entries[(uint64_t) (((unsigned __int128) pawnHash * numOfEntries) >> 64)];
+        }
+
+        int getSizeInMiB();
+
+    private:
+        Entry *entries;
+        uint64_t numOfEntries;
+        int sizeInMiB;
+};
+
+#endif
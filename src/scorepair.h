@@ -0,0 +1,81 @@
+#ifndef SCOREPAIR_H
+#define SCOREPAIR_H
+
+#include <cstdint>
+#include <iostream>
+
+/**
+ * a pair of middle game and end game scores. The final evaluation interpolates between them based on the game phase.
+ * Both scores are packed into one 32 bit integer (eg * 65536 + mg), so that adding, subtracting and scaling a pair
+ * is a single integer operation. This works as long as both scores stay inside the range of a short.
+ * The constructors are constexpr, so that tables of ScorePairs (like the default evaluation parameters) are packed
+ * at compile time and can be used during static initialization
+ */
+class ScorePair {
+    public:
+        constexpr ScorePair() : value(0) {}
+
+        constexpr ScorePair(int score) : ScorePair(score, score) {}
+
+        constexpr ScorePair(int mg, int eg) : value(((uint32_t) eg << 16) + (uint32_t) mg) {}
+
+        int mg() const {
+            return (int16_t) (value & 0xffff);
+        }
+
+        //a negative middle game score borrows from the end game half, which is undone by rounding
+        int eg() const {
+            return (int16_t) ((value + 0x8000) >> 16);
+        }
+
+        ScorePair operator+ (ScorePair obj) const {
+            return fromValue(this->value + obj.value);
+        }
+        ScorePair operator- (ScorePair obj) const {
+            return fromValue(this->value - obj.value);
+        }
+        ScorePair operator- () const {
+            return fromValue(-this->value);
+        }
+        ScorePair operator* (int factor) const {
+            return fromValue(this->value * (uint32_t) factor);
+        }
+        
+        ScorePair& operator+= (ScorePair obj) {
+            this->value += obj.value;
+            return *this;
+        }
+        ScorePair& operator-= (ScorePair obj) {
+            this->value -= obj.value;
+            return *this;
+        }
+        ScorePair& operator*= (int factor) {
+            this->value *= (uint32_t) factor;
+            return *this;
+        }
+
+        bool operator== (ScorePair obj) const {
+            return this->value == obj.value;
+        }
+
+        void print() {
+            std::cout << mg() << ", " << eg() << std::endl;
+        }
+
+        //the packed value. Sums of packed values can be computed outside of ScorePair, for example in vector registers
+        uint32_t getValue() const {
+            return value;
+        }
+
+        static ScorePair fromValue(uint32_t value) {
+            ScorePair score;
+            score.value = value;
+            return score;
+        }
+
+    private:
+        //unsigned, so that carries between the two halves are well defined
+        uint32_t value;
+};
+
+#endif
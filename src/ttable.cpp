@@ -1,75 +1,474 @@
 #include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <vector>
+#include <thread>
+#include <algorithm>
+
+#include <cstdio>
+#include <cerrno>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
 
 #include "ttable.h"
 
-TTable::Entry* TTable::table = nullptr;
+TTable::Bucket* TTable::table = nullptr;
+uint64_t TTable::numOfBuckets = 0;
 int TTable::sizeInMiB = 0;
+uint16_t TTable::generation = 0;
+bool TTable::checkStaticEvalGeneration = false;
+uint16_t TTable::staticEvalGeneration = 0;
+int TTable::searchesSinceEvalChange = 0;
+std::thread TTable::resizeThread;
+void *TTable::mapping = nullptr;
+uint64_t TTable::mappingSize = 0;
+TTable::FileHeader *TTable::sharedHeader = nullptr;
+std::string TTable::sharedName;
+uint16_t TTable::lastSharedGeneration = 0;
 
 void TTable::setSizeInMiB(int sizeInMiB) {
+    waitUntilReady();
+
+    if(TTable::sizeInMiB != sizeInMiB && sharedHeader == nullptr) {
+        resizeThread = std::thread(&allocate, sizeInMiB);
+    }
+}
+
+void TTable::waitUntilReady() {
+    if(resizeThread.joinable())
+        resizeThread.join();
+}
+
+void TTable::allocate(int sizeInMiB) {
+    Bucket *oldTable = table;
+    uint64_t oldNumOfBuckets = numOfBuckets;
+
+    uint64_t size = ((uint64_t) 1048576) * ((uint64_t) sizeInMiB);
+    uint64_t allocationSize = (size + hugePageSize - 1) / hugePageSize * hugePageSize;
+
+    Bucket *newTable = (Bucket*) aligned_alloc(hugePageSize, allocationSize);
+    if(newTable == nullptr) {
+        std::cerr << "could not allocate a hash table of " << sizeInMiB << " MiB" << std::endl;
+
+        //keep the old table. Without one, try smaller sizes
+        if(oldTable == nullptr && sizeInMiB > 1)
+            allocate(sizeInMiB / 2);
+        return;
+    }
+
+    table = newTable;
+    numOfBuckets = size / sizeof(Bucket);
+    TTable::sizeInMiB = sizeInMiB;
+
+    #ifdef __linux__
+        //ask for transparent huge pages. This fails silently if they are not supported
+        madvise(table, allocationSize, MADV_HUGEPAGE);
+    #endif
 
-    if(TTable::sizeInMiB != sizeInMiB) {
-        if(table != nullptr)
-            free(table);
+    //zeroing the table also makes the kernel map every page now instead of during the search
+    zero();
 
-        TTable::sizeInMiB = sizeInMiB;
-        table = (Entry*) calloc(((uint64_t) 1048576) * ((uint64_t) sizeInMiB), 1);
+    if(oldTable != nullptr) {
+        rehash(oldTable, oldNumOfBuckets);
+        release(oldTable);
+    } else {
+        generation = 0;
     }
 }
 
+void TTable::forEachBucketRange(const std::function<void(uint64_t begin, uint64_t end)>& work) {
+    int numOfThreads = std::max(std::thread::hardware_concurrency(), 1u);
+    uint64_t bucketsPerThread = (numOfBuckets + numOfThreads - 1) / numOfThreads;
+
+    std::vector<std::thread> threads;
+    for(int i = 0; i < numOfThreads; i++) {
+        uint64_t begin = std::min(i * bucketsPerThread, numOfBuckets);
+        uint64_t end = std::min(begin + bucketsPerThread, numOfBuckets);
+        threads.push_back(std::thread(work, begin, end));
+    }
+
+    for(std::thread& thread : threads) {
+        thread.join();
+    }
+}
+
+void TTable::zero() {
+    forEachBucketRange([](uint64_t begin, uint64_t end) {
+        memset((void *) &table[begin], 0, (end - begin) * sizeof(Bucket));
+    });
+}
+
+void TTable::rehash(Bucket *oldTable, uint64_t oldNumOfBuckets) {
+    /*
+    Every thread fills its own range of new buckets, so that no bucket is written by two threads.
+    As the bucket index is monotonic in the hash, the entries of a range of new buckets come from a range of old buckets,
+    which only has to be scanned once. Entries at the borders of that range that belong to another thread are skipped.
+    */
+    forEachBucketRange([oldTable, oldNumOfBuckets](uint64_t begin, uint64_t end) {
+        if(begin == end)
+            return;
+
+        uint64_t oldBegin = (uint64_t) (((unsigned __int128) begin * oldNumOfBuckets) / numOfBuckets);
+        uint64_t oldEnd = std::min((uint64_t) (((unsigned __int128) end * oldNumOfBuckets) / numOfBuckets) + 1, oldNumOfBuckets);
+
+        for(uint64_t i = oldBegin; i < oldEnd; i++) {
+            for(int j = 0; j < slotsPerBucket; j++) {
+                uint64_t key = oldTable[i].slots[j].key;
+                uint64_t data = oldTable[i].slots[j].data;
+                if(key == 0 && data == 0)
+                    continue;
+
+                uint64_t hash = key ^ data;
+                uint64_t index = getBucketIndex(hash, numOfBuckets);
+                if(index < begin || index >= end)
+                    continue;
+
+                //take an empty slot if there is one, otherwise replace the least valuable entry if it is less valuable than this one
+                Slot *slots = table[index].slots;
+                int minPriority = getReplacementPriority(unpack(data));
+                int minPrioritySlot = -1;
+                for(int k = 0; k < slotsPerBucket; k++) {
+                    if(slots[k].key == 0 && slots[k].data == 0) {
+                        minPrioritySlot = k;
+                        break;
+                    }
+                    int priority = getReplacementPriority(unpack(slots[k].data));
+                    if(priority < minPriority) {
+                        minPriority = priority;
+                        minPrioritySlot = k;
+                    }
+                }
+
+                if(minPrioritySlot != -1) {
+                    slots[minPrioritySlot].key = key;
+                    slots[minPrioritySlot].data = data;
+                }
+            }
+        }
+    });
+}
+
 void TTable::clear() {
-    free(table);
-    table = (Entry*) calloc(((uint64_t) 1048576) * ((uint64_t) sizeInMiB), 1);
+    waitUntilReady();
+
+    if(table == nullptr)
+        return;
+
+    zero();
+    generation = 0;
+    checkStaticEvalGeneration = false;
 }
 
-TTable::Entry * TTable::lookup(uint64_t hash) {
-    uint64_t index = (hash % ((1048576 / sizeof(Entry)) * sizeInMiB)) & ~0x3;
+void TTable::newSearch() {
+    if(sharedHeader != nullptr) {
+        //if another process started a search since the last one of this process, its generation is used. Otherwise a new one starts
+        uint16_t sharedGeneration = __atomic_load_n(&sharedHeader->generation, __ATOMIC_RELAXED);
+        if(sharedGeneration == lastSharedGeneration
+                && __atomic_compare_exchange_n(&sharedHeader->generation, &sharedGeneration, sharedGeneration + 1, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+            sharedGeneration++;
+        }
+        lastSharedGeneration = sharedGeneration;
+        generation = sharedGeneration & generationMask;
+    } else {
+        generation = (generation + 1) & generationMask;
+    }
+
+    if(checkStaticEvalGeneration && ++searchesSinceEvalChange >= generationMask)
+        checkStaticEvalGeneration = false;
+}
+
+void TTable::invalidateStaticEvals() {
+    waitUntilReady();
+
+    //entries of the current generation may already have been written with the old evaluation
+    newSearch();
+    checkStaticEvalGeneration = true;
+    staticEvalGeneration = generation;
+    searchesSinceEvalChange = 0;
+}
 
-    for(int i = 0; i < 4; i++) {
-        if(table[index+i].hash == hash) {
-            return &table[index+i];
+void TTable::prefetch(uint64_t hash) {
+    __builtin_prefetch(getBucket(hash));
+}
+
+bool TTable::lookup(uint64_t hash, Entry& entry) {
+    Slot *slots = getBucket(hash)->slots;
+
+    for(int i = 0; i < slotsPerBucket; i++) {
+        //read every word exactly once, the slot may be written concurrently
+        uint64_t key = slots[i].key;
+        uint64_t data = slots[i].data;
+        if((key ^ data) == hash) {
+            entry = unpack(data);
+            if(!hasCurrentStaticEval(entry))
+                entry.staticEval = noStaticEval;
+            return true;
         }
     }
 
-    return nullptr;
+    return false;
 }
 
-void TTable::insert(uint64_t hash, short eval, int nodeType, Move move, int depth) {
+void TTable::insert(uint64_t hash, short eval, int nodeType, Move move, int depth, short staticEval) {
     
     /*
     If the given position already is in the table, update the values if the new depth is greater or equal than the old depth.
-    Otherwise overwrite the slot with the smallest search depth, that doesn't contain an exact score.
-    If all slots contain an exact score, choose the slot with the smallest depth and overwrite only if the new entry is an exact score.
+    Otherwise overwrite a slot of an earlier search if there is one, else the slot with the smallest search depth, that doesn't contain an exact score.
+    If all slots contain an exact score of the current search, choose the slot with the smallest depth and overwrite only if the new entry is an exact score.
     */
     
-    uint64_t index = hash % ((1048576 / sizeof(Entry)) * sizeInMiB) & ~0x3;
-
+    Slot *slots = getBucket(hash)->slots;
 
     int minPriority = INT32_MAX;
     int minPrioritySlot = -1;
-    for(int i = 0; i < 4; i++) {
-        if(table[index+i].hash == hash) {
-            if(table[index+i].depth <= depth || (nodeType == 1 && table[index+i].entryType != 1)) {
+    Entry minPriorityEntry;
+    bool samePosition = false;
+    for(int i = 0; i < slotsPerBucket; i++) {
+        uint64_t key = slots[i].key;
+        uint64_t data = slots[i].data;
+        Entry entry = unpack(data);
+
+        if((key ^ data) == hash) {
+            if(entry.depth <= depth || (nodeType == 1 && entry.entryType != 1) || entry.generation != generation) {
                 minPrioritySlot = i;
+                minPriorityEntry = entry;
+                samePosition = true;
                 break;
             } else {
                 return;
             }
         }
-        int priority = table[index+i].depth + ((table[index+i].entryType == 1) << 30);
+        int priority = getReplacementPriority(entry);
         if(minPriority > priority) {
             minPriority = priority;
             minPrioritySlot = i;
+            minPriorityEntry = entry;
         }
     }
 
-    if(!(table[index+minPrioritySlot].entryType == 1 && nodeType != 1)) {
-        if(nodeType != 2)
-            table[index+minPrioritySlot].move = move.compress();
+    if(!(minPriorityEntry.entryType == 1 && nodeType != 1 && minPriorityEntry.generation == generation)) {
+        Entry entry;
+        //upper bounds don't have a best move, keep the move of the previous entry
+        entry.move = nodeType != 2 ? move.compress() : minPriorityEntry.move;
+        entry.eval = eval;
+        entry.entryType = nodeType;
+        entry.generation = generation;
+        entry.depth = depth;
+        //the static evaluation doesn't depend on the search, keep it if the new entry comes without one
+        entry.staticEval = (staticEval == noStaticEval && samePosition && hasCurrentStaticEval(minPriorityEntry)) ? minPriorityEntry.staticEval : staticEval;
 
-        table[index+minPrioritySlot].hash = hash;
-        table[index+minPrioritySlot].eval = eval;
-        table[index+minPrioritySlot].entryType = nodeType;
-        table[index+minPrioritySlot].depth = depth;
+        uint64_t data = pack(entry);
+        slots[minPrioritySlot].key = hash ^ data;
+        slots[minPrioritySlot].data = data;
     }
 }
+
+int TTable::getSizeInMiB() {
+    return sizeInMiB;
+}
+
+void TTable::release(Bucket *table) {
+    if(mapping != nullptr && (void *) table == (char *) mapping + fileHeaderSize) {
+        if(sharedHeader != nullptr && __atomic_sub_fetch(&sharedHeader->attachedProcesses, 1, __ATOMIC_ACQ_REL) == 0)
+            shm_unlink(sharedName.c_str());
+
+        munmap(mapping, mappingSize);
+        mapping = nullptr;
+        mappingSize = 0;
+        sharedHeader = nullptr;
+    } else {
+        free(table);
+    }
+}
+
+static uint64_t getZobristCheck() {
+    return Game::Position(START_POSITION_FEN).getPositionHash();
+}
+
+bool TTable::save(const std::string& path) {
+    waitUntilReady();
+
+    if(table == nullptr)
+        return false;
+
+    FILE *file = fopen(path.c_str(), "wb");
+    if(file == nullptr)
+        return false;
+
+    char headerBlock[fileHeaderSize] = {};
+    FileHeader *header = (FileHeader *) headerBlock;
+    memcpy(header->magic, "CALITOTT", 8);
+    header->version = fileFormatVersion;
+    header->sizeInMiB = sizeInMiB;
+    header->numOfBuckets = numOfBuckets;
+    header->zobristCheck = getZobristCheck();
+    header->generation = generation;
+
+    bool success = fwrite(headerBlock, fileHeaderSize, 1, file) == 1
+                && fwrite((void *) table, sizeof(Bucket), numOfBuckets, file) == numOfBuckets;
+
+    success = (fclose(file) == 0) && success;
+    return success;
+}
+
+bool TTable::load(const std::string& path) {
+    waitUntilReady();
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd == -1)
+        return false;
+
+    FileHeader header;
+    struct stat fileStatus;
+    bool valid = pread(fd, &header, sizeof(FileHeader), 0) == sizeof(FileHeader)
+              && fstat(fd, &fileStatus) == 0
+              && memcmp(header.magic, "CALITOTT", 8) == 0
+              && header.version == fileFormatVersion
+              && header.zobristCheck == getZobristCheck()
+              && header.numOfBuckets > 0
+              && (uint64_t) fileStatus.st_size == fileHeaderSize + header.numOfBuckets * sizeof(Bucket);
+
+    if(!valid) {
+        close(fd);
+        return false;
+    }
+
+    uint64_t size = fileStatus.st_size;
+    void *newMapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd); //the mapping stays valid
+
+    if(newMapping == MAP_FAILED)
+        return false;
+
+    if(table != nullptr)
+        release(table);
+
+    mapping = newMapping;
+    mappingSize = size;
+    table = (Bucket *) ((char *) mapping + fileHeaderSize);
+    numOfBuckets = header.numOfBuckets;
+    sizeInMiB = header.sizeInMiB;
+    generation = header.generation;
+    checkStaticEvalGeneration = false;
+
+    return true;
+}
+
+bool TTable::attachShared(const std::string& name, int sizeInMiB) {
+    waitUntilReady();
+
+    uint64_t size = fileHeaderSize + ((uint64_t) 1048576) * ((uint64_t) sizeInMiB) / sizeof(Bucket) * sizeof(Bucket);
+
+    //exactly one process creates and initializes the segment, all others wait until it is initialized
+    bool creator = true;
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600);
+    if(fd == -1 && errno == EEXIST) {
+        creator = false;
+        fd = shm_open(name.c_str(), O_RDWR, 0600);
+    }
+    if(fd == -1)
+        return false;
+
+    if(creator) {
+        //the new segment is filled with zeros
+        if(ftruncate(fd, size) != 0) {
+            close(fd);
+            shm_unlink(name.c_str());
+            return false;
+        }
+    } else {
+        struct stat segmentStatus;
+        for(int i = 0; i < 1000; i++) {
+            if(fstat(fd, &segmentStatus) != 0 || segmentStatus.st_size != 0)
+                break;
+            usleep(1000);
+        }
+        size = segmentStatus.st_size;
+    }
+
+    void *newMapping = size > fileHeaderSize ? mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd); //the mapping stays valid
+
+    if(newMapping == MAP_FAILED)
+        return false;
+
+    FileHeader *header = (FileHeader *) newMapping;
+
+    if(creator) {
+        header->version = fileFormatVersion;
+        header->sizeInMiB = sizeInMiB;
+        header->numOfBuckets = (size - fileHeaderSize) / sizeof(Bucket);
+        header->zobristCheck = getZobristCheck();
+        header->generation = 0;
+
+        //the magic marks the header as complete for the other processes
+        __atomic_thread_fence(__ATOMIC_RELEASE);
+        memcpy(header->magic, "CALITOTT", 8);
+    } else {
+        for(int i = 0; i < 1000 && memcmp((void *) header->magic, "CALITOTT", 8) != 0; i++) {
+            usleep(1000);
+        }
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    }
+
+    bool valid = memcmp(header->magic, "CALITOTT", 8) == 0
+              && header->version == fileFormatVersion
+              && header->zobristCheck == getZobristCheck()
+              && size == fileHeaderSize + header->numOfBuckets * sizeof(Bucket);
+
+    if(!valid) {
+        munmap(newMapping, size);
+        return false;
+    }
+
+    //counted before the previous table is released, which may be the same segment
+    __atomic_add_fetch(&header->attachedProcesses, 1, __ATOMIC_ACQ_REL);
+
+    if(table != nullptr)
+        release(table);
+
+    static bool exitHandlerRegistered = false;
+    if(!exitHandlerRegistered) {
+        std::atexit(&detachSharedAtExit);
+        exitHandlerRegistered = true;
+    }
+
+    mapping = newMapping;
+    mappingSize = size;
+    sharedHeader = header;
+    sharedName = name;
+    table = (Bucket *) ((char *) mapping + fileHeaderSize);
+    numOfBuckets = header->numOfBuckets;
+    TTable::sizeInMiB = header->sizeInMiB;
+    lastSharedGeneration = header->generation;
+    generation = lastSharedGeneration & generationMask;
+    checkStaticEvalGeneration = false;
+
+    return true;
+}
+
+void TTable::detachShared() {
+    waitUntilReady();
+
+    if(sharedHeader != nullptr) {
+        //copies the entries into newly allocated memory and unmaps the segment
+        allocate(sizeInMiB);
+    }
+}
+
+void TTable::detachSharedAtExit() {
+    waitUntilReady();
+
+    if(sharedHeader != nullptr) {
+        release(table);
+        table = nullptr;
+    }
+}
+
+bool TTable::isShared() {
+    return sharedHeader != nullptr;
+}
@@ -2,21 +2,57 @@
 #define TTABLE_H
 
 #include <cstdint>
+#include <thread>
+#include <functional>
+#include <string>
 
 #include "game.h"
 
 
 class TTable {
     public:
+        //the contents of a table entry, unpacked
         struct Entry {
-            uint64_t hash;
             uint16_t depth;
-            uint16_t entryType : 2;
+            uint8_t entryType;
+            uint16_t generation; //the search in which the entry was written, see newSearch()
             int16_t eval;
             uint16_t move;
+            int16_t staticEval; //noStaticEval if the position hasn't been evaluated
         };
 
-        static Entry *lookup(uint64_t hash);
+        static const int16_t noStaticEval = -32768;
+
+        /*
+            the table is shared by all search threads without any locking. Every slot consists of two 64 bit words:
+            the data word contains the packed entry, the key word the position hash xor the data word.
+            A slot that is read while another thread writes it may contain the key of one entry and the data of another,
+            but then the xor of both words doesn't give the hash of the position and the slot is treated as a miss
+        */
+        struct Slot {
+            uint64_t key;
+            uint64_t data; //bits 0-7: depth, 8-9: entry type, 10-15: generation, 16-31: eval, 32-47: move, 48-63: static eval
+        };
+
+        static const int slotsPerBucket = 4;
+
+        //the slots a position can be stored in. A bucket fills exactly one cache line
+        struct alignas(64) Bucket {
+            Slot slots[slotsPerBucket];
+        };
+
+        /**
+         * @param entry is set to a copy of the entry of the given position, if there is one.
+         * The move in the entry may still be illegal in the position (hash collision), it has to be checked before it is played
+         * @returns true if the position was found
+         */
+        static bool lookup(uint64_t hash, Entry& entry);
+
+        /**
+         * starts loading the bucket of the given position into the cache, so that a following lookup() or insert() doesn't have
+         * to wait for the memory access
+         */
+        static void prefetch(uint64_t hash);
 
         /**
          * inserts an entry into the table, if the replacement scheme allows it.
@@ -26,17 +62,180 @@ class TTable {
          * @param nodeType 0: eval is a lower bound; 1: eval is an exact score; 2: eval is an upper bound
          * @param move the best move. Only considered if nodeType is 0 or 1
          * @param depth the search depth with which the position has been searched
+         * @param staticEval the static evaluation of the position, noStaticEval if it hasn't been evaluated
          */
-        static void insert(uint64_t hash, short eval, int nodeType, Move move, int depth);
+        static void insert(uint64_t hash, short eval, int nodeType, Move move, int depth, short staticEval = noStaticEval);
 
+        /**
+         * resizes the table in the background. Must not be called during a search, and the table must not be used until waitUntilReady() has returned.
+         * The entries of the old table are moved into the new one. If the new table is smaller, the most valuable entries are kept.
+         * If the memory can't be allocated, the old table is kept. Without an old table the size is halved until the allocation succeeds
+         */
         static void setSizeInMiB(int sizeInMiB);
 
+        /**
+         * blocks until a resize started by setSizeInMiB() has finished
+         */
+        static void waitUntilReady();
+
+        /**
+         * removes all entries. Only needed when a new game starts, during a game entries of earlier searches are simply replaced first.
+         * A shared table is cleared for all attached processes
+         */
         static void clear();
 
+        /**
+         * increments the generation with which new entries are written. Entries of earlier searches are replaced first
+         */
+        static void newSearch();
+
+        /**
+         * makes the static evaluations of the entries in the table unusable, because the evaluation function changed.
+         * Entries keep their search results, lookup() returns them without the static evaluation
+         */
+        static void invalidateStaticEvals();
+
+        static int getSizeInMiB();
+
+        /**
+         * writes the table to the given file, behind a header describing the table. Must not be called during a search
+         * @returns false if the file couldn't be written
+         */
+        static bool save(const std::string& path);
+
+        /**
+         * replaces the table with the one stored in the given file. The file is mapped into memory copy-on-write, so loading is
+         * almost instant and the operating system only reads the parts of the table that are accessed. Changes are not written back,
+         * the table has to be saved again to keep them. The table size changes to the size stored in the file. Must not be called during a search
+         * @returns false if the file can't be read or was written with another entry format or other zobrist keys
+         */
+        static bool load(const std::string& path);
+
+        /**
+         * replaces the table with one in the named POSIX shared memory segment, which is created with the given size if it doesn't
+         * exist yet. All engine processes attached to the same segment probe and fill one common table. The entries of the current
+         * table are discarded. While attached, the size of the table is the size of the segment and can't be changed.
+         * The segment is removed when the last attached process detaches or exits. If a process is killed, its reference isn't
+         * dropped and the segment stays in /dev/shm until it is removed by hand. Must not be called during a search
+         * @param name the name of the segment, starting with a slash
+         * @returns false if the segment can't be opened or was created with another entry format or other zobrist keys
+         */
+        static bool attachShared(const std::string& name, int sizeInMiB);
+
+        /**
+         * moves the entries of the shared table into a table that is private to this process. The segment itself is kept for the
+         * other processes, or removed if no other process is attached. Must not be called during a search
+         */
+        static void detachShared();
+
+        static bool isShared();
+
     private:
         static int sizeInMiB;
 
-        static Entry *table;
+        static Bucket *table;
+        static uint64_t numOfBuckets;
+
+        static uint16_t generation;
+        static const uint16_t generationMask = 0x3f;
+
+        //static evaluations of entries written before the generation of the last evaluation change are ignored. Before the
+        //generations wrap around the check is dropped, by then the old entries have been replaced
+        static bool checkStaticEvalGeneration;
+        static uint16_t staticEvalGeneration;
+        static int searchesSinceEvalChange;
+
+        static std::thread resizeThread;
+
+        //a table loaded from a file or attached to a shared memory segment lives in a mapping instead of in allocated memory
+        static void *mapping;
+        static uint64_t mappingSize;
+
+        //frees the memory of the given table, whether it is allocated or mapped
+        static void release(Bucket *table);
+
+        //header of saved tables and shared memory segments
+        struct FileHeader {
+            char magic[8];
+            uint32_t version; //of the entry format
+            uint32_t sizeInMiB;
+            uint64_t numOfBuckets;
+            uint64_t zobristCheck; //hash of the starting position, differs if the file was written with other zobrist keys
+            uint16_t generation;
+            uint32_t attachedProcesses; //of a shared memory segment. The last process to detach removes the segment
+        };
+
+        //the header of the shared memory segment, if the table is shared. The generation in it is used by all attached processes
+        static FileHeader *sharedHeader;
+        static std::string sharedName;
+
+        //the shared generation when this process last started a search. If another process started one since then, it is
+        //joined instead of starting another generation, so that the generation doesn't advance once per attached process
+        static uint16_t lastSharedGeneration;
+
+        //drops the reference of this process to the shared memory segment when it exits
+        static void detachSharedAtExit();
+
+        static const uint32_t fileFormatVersion = 2;
+
+        //the table starts at a page boundary behind the header, as required by mmap
+        static const uint64_t fileHeaderSize = 4096;
+
+        //the table is aligned to and allocated in multiples of the huge page size, so that the kernel can back it with huge pages
+        static const uint64_t hugePageSize = 2 * 1048576;
+
+        static void allocate(int sizeInMiB);
+
+        //splits the buckets of the table into one contiguous range per hardware thread and processes the ranges in parallel
+        static void forEachBucketRange(const std::function<void(uint64_t begin, uint64_t end)>& work);
+
+        //zeroes the table
+        static void zero();
+
+        //moves all entries of the old table into the current table
+        static void rehash(Bucket *oldTable, uint64_t oldNumOfBuckets);
+
+        //the slot with the lowest priority is replaced first. Entries of earlier searches have the lowest priorities
+        static inline int getReplacementPriority(const Entry& entry) {
+            bool currentSearch = entry.generation == generation;
+            return entry.depth + (currentSearch << 29) + ((currentSearch && entry.entryType == 1) << 30);
+        }
+
+        //returns false if the static evaluation of the entry was computed by the evaluation function before the last change
+        static inline bool hasCurrentStaticEval(const Entry& entry) {
+            return !checkStaticEvalGeneration
+                || ((entry.generation - staticEvalGeneration) & generationMask) <= ((generation - staticEvalGeneration) & generationMask);
+        }
+
+        //maps the hash uniformly to a bucket by a multiplication with the number of buckets, taking the high 64 bits of the product.
+        //The mapping is monotonic, a contiguous range of buckets holds a contiguous range of hashes
+        static inline uint64_t getBucketIndex(uint64_t hash, uint64_t numOfBuckets) {
+            return (uint64_t) (((unsigned __int128) hash * numOfBuckets) >> 64);
+        }
+
+        static inline Bucket *getBucket(uint64_t hash) {
+            return &table[getBucketIndex(hash, numOfBuckets)];
+        }
+
+        static inline uint64_t pack(const Entry& entry) {
+            return ((uint64_t) entry.depth & 0xff)
+                 | (((uint64_t) entry.entryType & 0x3) << 8)
+                 | (((uint64_t) entry.generation & generationMask) << 10)
+                 | (((uint64_t) (uint16_t) entry.eval) << 16)
+                 | (((uint64_t) entry.move) << 32)
+                 | (((uint64_t) (uint16_t) entry.staticEval) << 48);
+        }
+
+        static inline Entry unpack(uint64_t data) {
+            Entry entry;
+            entry.depth = data & 0xff;
+            entry.entryType = (data >> 8) & 0x3;
+            entry.generation = (data >> 10) & generationMask;
+            entry.eval = (int16_t) ((data >> 16) & 0xffff);
+            entry.move = (data >> 32) & 0xffff;
+            entry.staticEval = (int16_t) ((data >> 48) & 0xffff);
+            return entry;
+        }
 };
 
 #endif
\ No newline at end of file
@@ -8,10 +8,19 @@
 #include <list>
 #include <stdexcept>
 #include <exception>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <chrono>
+#include <algorithm>
+#include <iterator>
 
 #include "game.h"
 #include "engine.h"
 #include "ttable.h"
+#include "nnue.h"
+#include "evalcache.h"
+#include "batcheval.h"
 
 
 #define AUTHOR "Lovis Hagemeyer"
@@ -20,6 +29,20 @@
 #define MIN_TABLE_SIZE 1
 #define MAX_TABLE_SIZE 4096
 #define DEFAULT_TABLE_SIZE 256
+#define DEFAULT_HASH_FILE "calito.hash"
+
+#define MIN_PAWN_TABLE_SIZE 1
+#define MAX_PAWN_TABLE_SIZE 256
+#define DEFAULT_PAWN_TABLE_SIZE 1
+
+#define DEFAULT_LMR_BASE 75
+#define DEFAULT_LMR_DIVISOR 225
+
+#define DEFAULT_LAZY_EVAL_MARGIN 600
+
+#define MIN_THREADS 1
+#define MAX_THREADS 512
+#define DEFAULT_THREADS 1
 
 
 uint64_t perft(int depth, Game& game, bool printMoveResults, bool useCache) {
@@ -31,15 +54,14 @@ uint64_t perft(int depth, Game& game, bool printMoveResults, bool useCache) {
     }
     uint64_t positionHash;
     uint64_t tableResult;
-    TTable::Entry *ttentry = nullptr;
+    TTable::Entry ttentry;
     if(useCache) {
         positionHash = game.pos->getPositionHash();
-        ttentry = TTable::lookup(positionHash);
-        if(ttentry != nullptr) {
-            if(ttentry->depth == depth) {
-                tableResult = ttentry->eval;
-                tableResult |= ((uint64_t) ttentry->entryType) << 16;
-                tableResult |= ((uint64_t) ttentry->move) << 32;
+        if(TTable::lookup(positionHash, ttentry)) {
+            if(ttentry.depth == depth) {
+                tableResult = ttentry.eval;
+                tableResult |= ((uint64_t) ttentry.entryType) << 16;
+                tableResult |= ((uint64_t) ttentry.move) << 32;
                 return tableResult;
             }
         }
@@ -65,20 +87,153 @@ uint64_t perft(int depth, Game& game, bool printMoveResults, bool useCache) {
 }
 
 
+/**
+ * returns the opcodes of an EPD line (the part behind the position), each with its terminating semicolon,
+ * without the ce opcode. Semicolons inside quoted operands don't end an opcode
+ */
+std::string getOpcodesWithoutCE(const std::string& opcodes) {
+    std::string result = "";
+    std::string opcode = "";
+    bool quoted = false;
+    for(char c : opcodes) {
+        if(c == '"')
+            quoted = !quoted;
+
+        if(c == ';' && !quoted) {
+            opcode.erase(0, opcode.find_first_not_of(' '));
+            if(opcode != "" && opcode.substr(0, 3) != "ce ")
+                result += " " + opcode + ";";
+            opcode = "";
+        } else {
+            opcode += c;
+        }
+    }
+    return result;
+}
+
+/**
+ * evaluates every position of an EPD or FEN file (one position per line) and prints it as EPD with the evaluation
+ * of the side to move in the ce opcode. Other opcodes of the input (like id and bm) are kept
+ */
+void evaluateFile(std::string fileName) {
+    std::ifstream file(fileName);
+    if(!file) {
+        std::cerr << "could not open " << fileName << std::endl;
+        return;
+    }
+
+    const size_t batchSize = 65536;
+    BatchEval::PositionBatch batch;
+    std::vector<std::string> epds; //with all opcodes except ce
+    std::vector<short> scores(batchSize);
+
+    uint64_t numOfPositions = 0;
+    auto startTime = std::chrono::steady_clock::now();
+
+    auto evaluateBatch = [&]() {
+        BatchEval::evaluate(batch, scores.data());
+        for(size_t i = 0; i < batch.size(); i++) {
+            std::cout << epds[i] << " ce " << scores[i] << ";\n";
+        }
+        numOfPositions += batch.size();
+        batch.clear();
+        epds.clear();
+    };
+
+    std::string line;
+    int lineNumber = 0;
+    while(std::getline(file, line)) {
+        lineNumber++;
+
+        std::istringstream fields(line);
+        std::string field[6];
+        int numOfFields = 0;
+        while(numOfFields < 4 && fields >> field[numOfFields])
+            numOfFields++;
+
+        if(numOfFields == 0)
+            continue;
+
+        //EPD lines have no move counters, but may have opcodes instead
+        std::streampos opcodesStart = fields.tellg();
+        bool hasCounters = fields >> field[4] >> field[5] && std::isdigit(field[4][0]) && std::isdigit(field[5][0]);
+        std::string opcodes = "";
+        if(!hasCounters) {
+            fields.clear();
+            fields.seekg(opcodesStart);
+        }
+        std::getline(fields, opcodes);
+
+        std::string epd = field[0] + " " + field[1] + " " + field[2] + " " + field[3];
+        std::string fen = epd + (hasCounters ? " " + field[4] + " " + field[5] : " 0 1");
+
+        try {
+            if(numOfFields < 4)
+                throw std::invalid_argument("too few fields");
+
+            Game::Position pos(fen);
+
+            //the evaluation relies on exactly one king per side
+            if(__builtin_popcountll(pos.kings & pos.ownPieces) != 1 || __builtin_popcountll(pos.kings & ~pos.ownPieces) != 1)
+                throw std::invalid_argument("not exactly one king per side");
+
+            batch.add(pos);
+            epds.push_back(epd + getOpcodesWithoutCE(opcodes));
+        } catch (std::exception& e) {
+            std::cerr << "invalid position in line " << lineNumber << ": " << line << std::endl;
+            continue;
+        }
+
+        if(batch.size() == batchSize)
+            evaluateBatch();
+    }
+    evaluateBatch();
+    std::cout << std::flush;
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    std::cerr << numOfPositions << " positions evaluated in " << seconds << " s" << std::endl;
+}
+
+
 struct engineOptions {
 
     int tableSize = DEFAULT_TABLE_SIZE;
+    std::string hashFile = DEFAULT_HASH_FILE;
+    int pawnTableSize = DEFAULT_PAWN_TABLE_SIZE;
+
+    int threads = DEFAULT_THREADS;
+
+    bool useNNUE = false;
+    int lazyEvalMargin = DEFAULT_LAZY_EVAL_MARGIN;
+
+    int lmrBase = DEFAULT_LMR_BASE;
+    int lmrDivisor = DEFAULT_LMR_DIVISOR;
 
 } options;
 
 std::mutex ioLock;
 
+/**
+ * stops a running search before a command changes state the search threads use. Must be called with the io lock held,
+ * which is released meanwhile to allow the search thread to print its result
+ */
+void stopSearch() {
+    ioLock.unlock();
+    Engine::stopCalculation();
+    ioLock.lock();
+}
+
 
 int main(int argc, char **argv) {
 
     Game game;
     std::string input;
 
+    if(argc == 3 && std::strcmp(argv[1], "eval") == 0) {
+        evaluateFile(argv[2]);
+        return 0;
+    }
+
     if(argc >= 5) {
         if(std::strcmp(argv[1], "perft") == 0) {
 
@@ -91,6 +246,7 @@ int main(int argc, char **argv) {
             }
             game = Game(fen);
             TTable::setSizeInMiB(1024);
+            TTable::waitUntilReady();
             std::cout << perft(depth, game, true, useCache) << std::endl;
             return 0;
         }    
@@ -106,7 +262,19 @@ int main(int argc, char **argv) {
     
     //possible options
     std::cout << "option name Hash type spin default " << DEFAULT_TABLE_SIZE << " min " << MIN_TABLE_SIZE << " max " << MAX_TABLE_SIZE << std::endl;
+    std::cout << "option name Clear Hash type button" << std::endl;
+    std::cout << "option name HashFile type string default " << DEFAULT_HASH_FILE << std::endl;
+    std::cout << "option name Save Hash type button" << std::endl;
+    std::cout << "option name Load Hash type button" << std::endl;
+    std::cout << "option name SharedHash type string default <empty>" << std::endl;
+    std::cout << "option name PawnHash type spin default " << DEFAULT_PAWN_TABLE_SIZE << " min " << MIN_PAWN_TABLE_SIZE << " max " << MAX_PAWN_TABLE_SIZE << std::endl;
+    std::cout << "option name EvalFile type string default <empty>" << std::endl;
+    std::cout << "option name UseNNUE type check default false" << std::endl;
+    std::cout << "option name LazyEvalMargin type spin default " << DEFAULT_LAZY_EVAL_MARGIN << " min 0 max " << Engine::maxLazyEvalMargin << std::endl;
     std::cout << "option name Ponder type check default true" << std::endl;
+    std::cout << "option name Threads type spin default " << DEFAULT_THREADS << " min " << MIN_THREADS << " max " << MAX_THREADS << std::endl;
+    std::cout << "option name LMRBase type spin default " << DEFAULT_LMR_BASE << " min 0 max 300" << std::endl;
+    std::cout << "option name LMRDivisor type spin default " << DEFAULT_LMR_DIVISOR << " min 100 max 1000" << std::endl;
 
     std::cout << "uciok" << std::endl;
 
@@ -134,6 +302,7 @@ int main(int argc, char **argv) {
         if(command == "quit") {
             ioLock.unlock();
             Engine::stopCalculation();
+            TTable::waitUntilReady();
             exit(EXIT_SUCCESS);
         }
 
@@ -142,6 +311,122 @@ int main(int argc, char **argv) {
                 int tableSize = std::stoi(input.substr(26, std::string::npos));
                 if(tableSize <= MAX_TABLE_SIZE && tableSize >= MIN_TABLE_SIZE) {
                     options.tableSize = tableSize;
+
+                    //the old table is released when the resize is done, no search may use it anymore
+                    stopSearch();
+                    TTable::setSizeInMiB(tableSize); //resized in the background, isready waits for it
+                }
+            }
+
+            if(std::regex_match(input, std::regex("setoption name (t|T)(h|H)(r|R)(e|E)(a|A)(d|D)(s|S) value [0-9]+"))) {
+                int threads = std::stoi(input.substr(29, std::string::npos));
+                if(threads <= MAX_THREADS && threads >= MIN_THREADS) {
+                    options.threads = threads;
+                }
+            }
+
+            //a shared table is not cleared, as that would wipe it for all other attached processes. Detach first to clear a private copy
+            if(std::regex_match(input, std::regex("setoption name clear hash", std::regex::icase))) {
+                if(TTable::isShared()) {
+                    std::cerr << "the shared hash table is not cleared, set SharedHash to <empty> first" << std::endl;
+                } else {
+                    //a running search would refill the table right away
+                    stopSearch();
+                    TTable::clear();
+                }
+            }
+
+            //the transposition table can be stored in a file, to continue an analysis later
+            if(std::regex_match(input, std::regex("setoption name hashfile value .+", std::regex::icase))) {
+                options.hashFile = input.substr(30, std::string::npos);
+            }
+
+            //the table is saved and loaded while no search writes to it, so that the file holds no half written entries
+            //and no search uses the replaced table
+            if(std::regex_match(input, std::regex("setoption name save hash", std::regex::icase))) {
+                stopSearch();
+                if(!TTable::save(options.hashFile)) {
+                    std::cerr << "could not save the hash table to " << options.hashFile << std::endl;
+                }
+            }
+
+            if(std::regex_match(input, std::regex("setoption name load hash", std::regex::icase))) {
+                stopSearch();
+                if(TTable::load(options.hashFile)) {
+                    options.tableSize = TTable::getSizeInMiB();
+                } else {
+                    std::cerr << "could not load a compatible hash table from " << options.hashFile << std::endl;
+                }
+            }
+
+            //several engine processes can share one table in a named shared memory segment. An empty name gives a private table again.
+            //The segment is removed when the last process detaches or exits
+            if(std::regex_match(input, std::regex("setoption name sharedhash value.*", std::regex::icase))) {
+                stopSearch(); //the table is replaced
+                std::string name = input.size() > 32 ? input.substr(32, std::string::npos) : "";
+                if(name == "" || name == "<empty>") {
+                    TTable::detachShared();
+                } else {
+                    if(name[0] != '/')
+                        name = "/" + name;
+
+                    if(TTable::attachShared(name, options.tableSize)) {
+                        options.tableSize = TTable::getSizeInMiB();
+                    } else {
+                        std::cerr << "could not attach to a compatible shared hash table " << name << std::endl;
+                    }
+                }
+            }
+
+            //size of the pawn table of each search thread
+            if(std::regex_match(input, std::regex("setoption name pawnhash value [0-9]+", std::regex::icase))) {
+                int pawnTableSize = std::stoi(input.substr(30, std::string::npos));
+                if(pawnTableSize <= MAX_PAWN_TABLE_SIZE && pawnTableSize >= MIN_PAWN_TABLE_SIZE) {
+                    options.pawnTableSize = pawnTableSize;
+                }
+            }
+
+            //weights of the neural network evaluation
+            if(std::regex_match(input, std::regex("setoption name evalfile value .+", std::regex::icase))) {
+                std::string evalFile = input.substr(30, std::string::npos);
+                if(evalFile != "<empty>") {
+                    //the weights are replaced, a running search must not evaluate with them
+                    stopSearch();
+
+                    if(NNUE::load(evalFile)) {
+                        //cached and stored static evaluations may be from the previous network
+                        EvalCache::clear();
+                        TTable::invalidateStaticEvals();
+                    } else {
+                        std::cerr << "could not load a compatible network from " << evalFile << std::endl;
+                    }
+                }
+            }
+
+            if(std::regex_match(input, std::regex("setoption name usennue value (true|false)", std::regex::icase))) {
+                options.useNNUE = std::regex_match(input, std::regex(".*true", std::regex::icase));
+            }
+
+            //margin of the lazy evaluation in the quiescence search, for tuning
+            if(std::regex_match(input, std::regex("setoption name lazyevalmargin value [0-9]+", std::regex::icase))) {
+                int lazyEvalMargin = std::stoi(input.substr(36, std::string::npos));
+                if(lazyEvalMargin <= Engine::maxLazyEvalMargin) {
+                    options.lazyEvalMargin = lazyEvalMargin;
+                }
+            }
+
+            //late move reduction parameters, for tuning
+            if(std::regex_match(input, std::regex("setoption name lmrbase value [0-9]+", std::regex::icase))) {
+                int lmrBase = std::stoi(input.substr(29, std::string::npos));
+                if(lmrBase <= 300) {
+                    options.lmrBase = lmrBase;
+                }
+            }
+
+            if(std::regex_match(input, std::regex("setoption name lmrdivisor value [0-9]+", std::regex::icase))) {
+                int lmrDivisor = std::stoi(input.substr(32, std::string::npos));
+                if(lmrDivisor <= 1000 && lmrDivisor >= 100) {
+                    options.lmrDivisor = lmrDivisor;
                 }
             }
 
@@ -150,11 +435,16 @@ int main(int argc, char **argv) {
 
         if(command == "isready") {
             TTable::setSizeInMiB(options.tableSize);
+            TTable::waitUntilReady();
+            options.tableSize = TTable::getSizeInMiB(); //differs if the table couldn't be allocated
             std::cout << "readyok" << std::endl;
         } 
 
         if(command == "ucinewgame") {
-            //do nothing, a table filled with mostly useless data is better than an empty table
+            //positions of the previous game won't occur again. Between the moves of a game the table is kept.
+            //A shared table is not cleared, as the other processes may still need its entries
+            if(!TTable::isShared())
+                TTable::clear();
         }
 
         if(command == "debug") {
@@ -166,7 +456,12 @@ int main(int argc, char **argv) {
         }
 
         if(command == "position") {
-            if(args.front() == "fen") {
+            //the game must leave room in the position history for the moves made during a search
+            auto movesStart = std::find(args.begin(), args.end(), "moves");
+            int numOfMoves = movesStart == args.end() ? 0 : std::distance(movesStart, args.end()) - 1;
+            if(numOfMoves >= Game::maxGameLength) {
+                std::cerr << "too many moves, at most " << Game::maxGameLength - 1 << " are supported" << std::endl;
+            } else if(args.front() == "fen") {
                 std::string fen = "";
                 args.pop_front();
                 while (args.front() != "moves") {
@@ -263,7 +558,18 @@ int main(int argc, char **argv) {
                     }
                 }
             }
+            //a go during pondering or an infinite search replaces that search. It is stopped before the options change
+            //the tables and settings its threads are reading
+            stopSearch();
+
             TTable::setSizeInMiB(options.tableSize);
+            TTable::waitUntilReady();
+            options.tableSize = TTable::getSizeInMiB(); //differs if the table couldn't be allocated
+            Engine::setNumThreads(options.threads);
+            Engine::setLMRParameters(options.lmrBase, options.lmrDivisor);
+            Engine::setPawnTableSize(options.pawnTableSize);
+            Engine::setUseNNUE(options.useNNUE);
+            Engine::setLazyEvalMargin(options.lazyEvalMargin);
             ioLock.unlock();
             Engine::startAnalyzing(game, goOptions);
             ioLock.lock();
@@ -274,9 +580,7 @@ int main(int argc, char **argv) {
         }
 
         if(command == "stop") {
-            ioLock.unlock(); //allow the thread to print the result
-            Engine::stopCalculation();
-            ioLock.lock();
+            stopSearch();
         }
 
         ioLock.unlock();
@@ -36,7 +36,8 @@ for x in file:
 
     while(True) :
         line = p.stdout.readline()
-        if(line[:10] == "info depth"):
+        #lines with a bound report a failed aspiration window, the search of that depth is repeated
+        if(line[:10] == "info depth" and not re.search("upperbound|lowerbound", line)):
 
             regex = re.compile("nodes ([0-9]+)")
             nodes[positionNum].append(int(re.search(regex, line)[1]))